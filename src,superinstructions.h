@@ -0,0 +1,69 @@
+/* Superinstructions for the threaded Nga engine in src,vm.c.
+
+   Generated by `make` from a bundle profile of the bootstrap and the
+   tools. Do not edit. */
+
+SUPER(2063, FE, CA, NO, NO)
+SUPER(285281281, LI, NE, LI, AD)
+SUPER(268505089, LI, ST, LI, ST)
+SUPER(524545, LI, LI, CA, NO)
+SUPER(101777669, PU, LI, AD, PO)
+SUPER(17108738, DU, FE, PU, LI)
+SUPER(251790353, AD, SW, DU, FE)
+SUPER(17565186, DU, PO, NE, LI)
+SUPER(50529798, PO, PO, DR, DR)
+SUPER(1793, LI, JU, NO, NO)
+SUPER(134287105, LI, FE, LI, CA)
+SUPER(524546, DU, LI, CA, NO)
+SUPER(659713, LI, AD, RE, NO)
+SUPER(459023, FE, LI, JU, NO)
+SUPER(2305, LI, CC, NO, NO)
+SUPER(16974595, DR, DR, DR, LI)
+SUPER(2049, LI, CA, NO, NO)
+SUPER(524547, DR, LI, CA, NO)
+SUPER(68223234, DU, LI, AD, SW)
+SUPER(2575, FE, RE, NO, NO)
+SUPER(525572, SW, PU, CA, NO)
+SUPER(3841, LI, FE, NO, NO)
+SUPER(656912, ST, PO, RE, NO)
+SUPER(85000450, DU, LI, AD, PU)
+SUPER(659457, LI, ST, RE, NO)
+SUPER(459011, DR, LI, JU, NO)
+SUPER(67502597, PU, DU, PO, SW)
+SUPER(1542, PO, PO, NO, NO)
+SUPER(33886721, LI, SU, PU, DU)
+SUPER(2053, PU, CA, NO, NO)
+SUPER(4367, FE, AD, NO, NO)
+SUPER(17826050, DU, LI, ST, LI)
+SUPER(167838467, DR, DR, LI, RE)
+SUPER(659201, LI, FE, RE, NO)
+SUPER(134287361, LI, ST, LI, CA)
+SUPER(17826049, LI, LI, ST, LI)
+SUPER(4097, LI, ST, NO, NO)
+SUPER(2576, ST, RE, NO, NO)
+SUPER(134284303, FE, SW, LI, CA)
+SUPER(117506305, LI, LI, LI, JU)
+SUPER(2572, NE, RE, NO, NO)
+SUPER(285278479, FE, LI, LI, AD)
+SUPER(1807, FE, JU, NO, NO)
+SUPER(1641217, LI, EQ, ZR, NO)
+SUPER(302256641, LI, SU, SW, SU)
+SUPER(167841793, LI, ST, LI, RE)
+SUPER(525570, DU, PU, CA, NO)
+SUPER(1639430, PO, SW, ZR, NO)
+SUPER(459009, LI, LI, JU, NO)
+SUPER(17563906, DU, LI, NE, LI)
+SUPER(1642241, LI, FE, ZR, NO)
+SUPER(33883396, SW, PU, PU, DU)
+SUPER(101450758, PO, SW, NE, PO)
+SUPER(6404, SW, ZR, NO, NO)
+SUPER(786703, FE, LI, NE, NO)
+SUPER(16846593, LI, FE, LI, LI)
+SUPER(772, SW, DR, NO, NO)
+SUPER(285282049, LI, FE, LI, AD)
+SUPER(771, DR, DR, NO, NO)
+SUPER(459012, SW, LI, JU, NO)
+SUPER(168820993, LI, LI, ST, RE)
+SUPER(268767489, LI, AD, PU, ST)
+SUPER(285278725, PU, DU, LI, AD)
+SUPER(33951492, SW, FE, PO, DU)
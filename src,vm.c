@@ -6,22 +6,38 @@
   Jay Skeer, and Kenneth Keating.
   ---------------------------------------------------------------------*/
 
-#include <ctype.h>
 #include <dirent.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+#include <time.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define CELL int32_t
 #define CELL_MIN INT_MIN + 1
 #define CELL_MAX INT_MAX - 1
-#define IMAGE_SIZE  32000000      /* Amount of RAM, in cells           */
+#define IMAGE_SIZE  32000000      /* Default amount of RAM, in cells   */
+#define MIN_IMAGE_SIZE  65536     /* Limits for `-m` and RX_IMAGE_SIZE */
+#define MAX_IMAGE_SIZE  0x1FFFFFFF
 #define ADDRESSES    256          /* Depth of address stack            */
 #define STACK_DEPTH  256          /* Depth of data stack               */
 #define TIB        memory[7]      /* Location of TIB                   */
@@ -31,8 +47,38 @@
 #define D_OFFSET_CLASS    2
 #define D_OFFSET_NAME     3
 
+#if defined(NGA_THREADED) && !defined(__GNUC__)
+#undef NGA_THREADED               /* Computed goto is a GCC extension  */
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+#if defined(NGA_JIT) && !(defined(__x86_64__) && defined(MAP_ANONYMOUS))
+#undef NGA_JIT                    /* The JIT only targets x86-64       */
+#endif
+
+#if defined(NGA_NATIVE) && !defined(NGA_THREADED)
+#undef NGA_NATIVE                 /* Compiled code is threaded code    */
+#endif
+#if defined(NGA_NATIVE) && defined(NGA_JIT)
+#undef NGA_JIT                    /* and takes the place of the JIT    */
+#endif
+
+/* Each thread runs its own VM, so everything belonging to one is
+   kept per thread. The devices are shared. */
+#define VM_LOCAL  __thread
+
 #define MAX_DEVICES      32
 #define MAX_OPEN_FILES   32
+#define MAX_FILE_VIEWS   32
+#define MAX_OPEN_DIRS    16
+#define MAX_PROCESSES    32
+#define MAX_WATCHES      64
 
 CELL stack_pop();
 void stack_push(CELL value);
@@ -41,7 +87,7 @@ char *string_extract(CELL at);
 CELL d_xt_for(char *Name, CELL Dictionary);
 void update_rx();
 void include_file(char *fname);
-void register_device(void *handler, void *query);
+void register_device(void *handler, void *query, char *name, int actions);
 void io_output();
 void query_output();
 void io_keyboard();
@@ -50,21 +96,39 @@ void query_filesystem();
 void io_filesystem();
 void query_unix();
 void io_unix();
+void file_read_available();
+void file_write_available();
+void file_pipe();
+void file_close_pipe();
+void file_truncate();
+void file_at_end();
 void io_scripting();
 void query_scripting();
 void io_rng();
 void query_rng();
 
 CELL load_image();
+void image_save(char *fname, CELL entry);
+int image_load(char *fname);
 void prepare_vm();
+void run_arguments(int argc, char **argv);
+void run_tool(int argc, char **argv);
+void snapshot_take(char *binary);
+int snapshot_matches(char **argv);
+void snapshot_run(int argc, char **argv);
+void jobs_forget();
+void io_jobs();
+void query_jobs();
 void process_opcode(CELL opcode);
 void process_opcode_bundle(CELL opcode);
 int validate_opcode_bundle(CELL opcode);
 
-CELL sp, rp, ip;                  /* Stack & instruction pointers      */
-CELL data[STACK_DEPTH];           /* The data stack                    */
-CELL address[ADDRESSES];          /* The address stack                 */
-CELL memory[IMAGE_SIZE + 1];      /* The memory for the image          */
+VM_LOCAL CELL sp, rp, ip;         /* Stack & instruction pointers      */
+VM_LOCAL CELL data[STACK_DEPTH];  /* The data stack                    */
+VM_LOCAL CELL address[ADDRESSES]; /* The address stack                 */
+VM_LOCAL CELL *memory;            /* The memory for the image          */
+CELL image_size;                  /* Cells of memory (see `-m`)        */
+CELL ToolEntry;                   /* Word run by a tool image, or 0    */
 
 #define TOS  data[sp]             /* Shortcut for top item on stack    */
 #define NOS  data[sp-1]           /* Shortcut for second item on stack */
@@ -72,25 +136,82 @@ CELL memory[IMAGE_SIZE + 1];      /* The memory for the image          */
 
 typedef void (*Handler)(void);
 
+extern Handler JobActions[5];    /* Defined with the jobs, below       */
+
 Handler IO_deviceHandlers[MAX_DEVICES];
 Handler IO_queryHandlers[MAX_DEVICES];
+char *IO_deviceNames[MAX_DEVICES];
+int IO_deviceActions[MAX_DEVICES];  /* Size of its action table, or 0  */
 int devices;
 
-CELL Dictionary;
-CELL interpret;
+VM_LOCAL uint64_t io_moved;       /* Bytes moved by I/O, for the stats */
 
-char string_data[8192];
-char **sys_argv;
-int sys_argc;
+VM_LOCAL CELL Dictionary;
+VM_LOCAL CELL interpret;
 
-void register_device(void *handler, void *query) {
+VM_LOCAL char string_data[8192];
+VM_LOCAL char **sys_argv;
+VM_LOCAL int sys_argc;
+
+void register_device(void *handler, void *query, char *name, int actions) {
   IO_deviceHandlers[devices] = handler;
   IO_queryHandlers[devices] = query;
+  IO_deviceNames[devices] = name;
+  IO_deviceActions[devices] = actions;
   devices++;
 }
 
 
-FILE *OpenFileHandles[MAX_OPEN_FILES];
+VM_LOCAL FILE *OpenFileHandles[MAX_OPEN_FILES];
+
+/* A file handle can be a pipe to or from a child process, which is
+   waited for when it's closed. */
+
+VM_LOCAL pid_t PipeChild[MAX_OPEN_FILES];
+
+/* Output goes to standard output, unless redirected to a file. */
+
+#define MAX_REDIRECTS  8
+
+VM_LOCAL FILE *Output;
+VM_LOCAL FILE *OutputStack[MAX_REDIRECTS];
+VM_LOCAL int OutputDepth;
+
+FILE *output_stream() {
+  return Output ? Output : stdout;
+}
+
+/* An exit status is the exit code, or 128 plus the signal number if
+   the process was killed, as with a shell. */
+CELL exit_status(int status) {
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  return 128 + WTERMSIG(status);
+}
+
+CELL file_wait_child(CELL slot) {
+  int status;
+  pid_t pid = PipeChild[slot];
+  PipeChild[slot] = 0;
+  while (waitpid(pid, &status, 0) < 0)
+    if (errno != EINTR)
+      return -1;
+  return exit_status(status);
+}
+
+/* Each open file can have an index of the offsets at which its lines
+   start. It's built on first use by `file_lines()` or
+   `file_seek_line()`, and dropped when the file is written to or
+   closed. */
+
+VM_LOCAL long *LineIndex[MAX_OPEN_FILES];
+VM_LOCAL CELL LineCount[MAX_OPEN_FILES];
+
+void file_forget_lines(CELL slot) {
+  free(LineIndex[slot]);
+  LineIndex[slot] = NULL;
+  LineCount[slot] = 0;
+}
 
 CELL files_get_handle() {
   CELL i;
@@ -124,6 +245,8 @@ void file_read() {
   CELL c;
   CELL slot = stack_pop();
   c = fgetc(OpenFileHandles[slot]);
+  if (c != EOF)
+    io_moved++;
   stack_push(feof(OpenFileHandles[slot]) ? 0 : c);
 }
 
@@ -132,12 +255,29 @@ void file_write() {
   slot = stack_pop();
   c = stack_pop();
   fputc(c, OpenFileHandles[slot]);
+  io_moved++;
+  file_forget_lines(slot);
 }
 
-void file_close() {
-  CELL slot = stack_pop();
-  fclose(OpenFileHandles[slot]);
+CELL file_close_slot(CELL slot) {
+  FILE *f;
+  int i;
+  if (slot <= 0 || slot >= MAX_OPEN_FILES || OpenFileHandles[slot] == 0)
+    return -1;
+  f = OpenFileHandles[slot];
+  if (Output == f)
+    Output = NULL;
+  for (i = 0; i < OutputDepth; i++)
+    if (OutputStack[i] == f)
+      OutputStack[i] = NULL;
+  fclose(f);
   OpenFileHandles[slot] = 0;
+  file_forget_lines(slot);
+  return PipeChild[slot] ? file_wait_child(slot) : 0;
+}
+
+void file_close() {
+  file_close_slot(stack_pop());
 }
 
 void file_get_position() {
@@ -157,6 +297,11 @@ void file_get_size() {
   struct stat buffer;
   slot = stack_pop();
   fstat(fileno(OpenFileHandles[slot]), &buffer);
+  if (S_ISREG(buffer.st_mode)) {
+    current = ftell(OpenFileHandles[slot]);
+    stack_push(current > buffer.st_size ? current : buffer.st_size);
+    return;
+  }
   if (!S_ISDIR(buffer.st_mode)) {
     current = ftell(OpenFileHandles[slot]);
     r = fseek(OpenFileHandles[slot], 0, SEEK_END);
@@ -180,16 +325,341 @@ void file_flush() {
   fflush(OpenFileHandles[stack_pop()]);
 }
 
-Handler FileActions[10] = {
+/* The block transfers move `n` bytes between a file and a range of
+   cells in one call. They either use one cell per byte, or pack four
+   bytes into each cell (low byte first, as in the image files). */
+
+VM_LOCAL unsigned char file_block[64 * 1024];
+
+CELL file_block_limit(CELL at, CELL n, int packed) {
+  CELL room;
+  if (at < 0 || at > image_size || n < 0)
+    return 0;
+  room = image_size - at;
+  if (packed && n / 4 >= room)
+    return room * 4;
+  if (!packed && n > room)
+    return room;
+  return n;
+}
+
+void file_read_block(int packed) {
+  CELL slot, n, at, done, got, want, i, k;
+  slot = stack_pop();
+  n = stack_pop();
+  at = stack_pop();
+  n = file_block_limit(at, n, packed);
+  for (done = 0; done < n && OpenFileHandles[slot] != 0; done += got) {
+    want = (n - done < (CELL)sizeof(file_block)) ? n - done : (CELL)sizeof(file_block);
+    got = fread(file_block, 1, want, OpenFileHandles[slot]);
+    for (i = 0; i < got; i++) {
+      k = done + i;
+      if (!packed)
+        memory[at + k] = file_block[i];
+      else if ((k & 3) == 0)
+        memory[at + k / 4] = file_block[i];
+      else
+        memory[at + k / 4] = (CELL)((uint32_t)memory[at + k / 4] |
+                                    ((uint32_t)file_block[i] << ((k & 3) * 8)));
+    }
+    if (got < want) {
+      done += got;
+      break;
+    }
+  }
+  io_moved += done;
+  stack_push(done);
+}
+
+void file_write_block(int packed) {
+  CELL slot, n, at, done, want, i, k;
+  slot = stack_pop();
+  n = stack_pop();
+  at = stack_pop();
+  n = file_block_limit(at, n, packed);
+  file_forget_lines(slot);
+  for (done = 0; done < n && OpenFileHandles[slot] != 0; done += want) {
+    want = (n - done < (CELL)sizeof(file_block)) ? n - done : (CELL)sizeof(file_block);
+    for (i = 0; i < want; i++) {
+      k = done + i;
+      if (!packed)
+        file_block[i] = (unsigned char)memory[at + k];
+      else
+        file_block[i] = (unsigned char)((uint32_t)memory[at + k / 4] >> ((k & 3) * 8));
+    }
+    if (fwrite(file_block, 1, want, OpenFileHandles[slot]) != (size_t)want)
+      break;
+  }
+  io_moved += done;
+}
+
+void file_read_bytes()   { file_read_block(0);  }
+void file_write_bytes()  { file_write_block(0); }
+void file_read_packed()  { file_read_block(1);  }
+void file_write_packed() { file_write_block(1); }
+
+/* Lines end at a CR, LF, or NUL. Reading one stores up to `n`
+   characters of it (or as many as fit if `n` is negative), discarding
+   any more, and returns a flag that is true if more of the file
+   follows. */
+
+void file_next_line() {
+  CELL slot = stack_pop();
+  CELL max = stack_pop();
+  CELL at = stack_pop();
+  CELL length = 0;
+  FILE *f = OpenFileHandles[slot];
+  int c;
+  if (at < 0 || at >= image_size || f == NULL) {
+    stack_push(0);
+    return;
+  }
+  if (max < 0 || max > image_size - at - 1)
+    max = image_size - at - 1;
+  flockfile(f);
+  while ((c = getc_unlocked(f)) != EOF && c != 10 && c != 13 && c != 0)
+    if (length < max)
+      memory[at + length++] = c;
+  if (c != EOF && (c = getc_unlocked(f)) != EOF)
+    ungetc(c, f);
+  funlockfile(f);
+  memory[at + length] = 0;
+  io_moved += length;
+  stack_push(c == EOF ? 0 : -1);
+}
+
+/* The index holds the offset of each line start, matching the lines
+   `file_next_line()` returns: an empty file has one empty line, and
+   a final line ending is not followed by another line. */
+
+int file_index_lines(CELL slot) {
+  FILE *f = OpenFileHandles[slot];
+  long position, offset = 0, capacity = 1024;
+  long *more;
+  size_t got, i;
+  int last = 10;
+  if (f == NULL)
+    return 0;
+  if (LineIndex[slot])
+    return 1;
+  position = ftell(f);
+  if ((LineIndex[slot] = malloc(capacity * sizeof(long))) == NULL)
+    return 0;
+  LineIndex[slot][0] = 0;
+  LineCount[slot] = 1;
+  fseek(f, 0, SEEK_SET);
+  while ((got = fread(file_block, 1, sizeof(file_block), f)) > 0) {
+    for (i = 0; i < got; i++, offset++) {
+      if ((last == 10 || last == 13 || last == 0) && offset > 0) {
+        if (LineCount[slot] == capacity) {
+          capacity *= 2;
+          if ((more = realloc(LineIndex[slot], capacity * sizeof(long))) == NULL) {
+            free(LineIndex[slot]);
+            LineIndex[slot] = NULL;
+            LineCount[slot] = 0;
+            clearerr(f);
+            fseek(f, position, SEEK_SET);
+            return 0;
+          }
+          LineIndex[slot] = more;
+        }
+        LineIndex[slot][LineCount[slot]++] = offset;
+      }
+      last = file_block[i];
+    }
+  }
+  clearerr(f);
+  fseek(f, position, SEEK_SET);
+  return 1;
+}
+
+void file_lines() {
+  CELL slot = stack_pop();
+  stack_push(file_index_lines(slot) ? LineCount[slot] : 0);
+}
+
+void file_seek_line() {
+  CELL slot = stack_pop();
+  CELL line = stack_pop();
+  if (!file_index_lines(slot))
+    return;
+  if (line < 0)
+    line = 0;
+  if (line >= LineCount[slot])
+    fseek(OpenFileHandles[slot], 0, SEEK_END);
+  else
+    fseek(OpenFileHandles[slot], LineIndex[slot][line], SEEK_SET);
+}
+
+/* Views map a file read-only, so that it can be searched and read
+   from without copying it into the image. Offsets are in bytes, and
+   views are limited to files of under 2GB. Slot 0 is never used, so
+   a failed mapping returns 0, as with `file_open()`. */
+
+VM_LOCAL struct FileView {
+  unsigned char *data;
+  CELL size;
+} FileViews[MAX_FILE_VIEWS];
+
+struct FileView *file_view(CELL slot) {
+  if (slot <= 0 || slot >= MAX_FILE_VIEWS || FileViews[slot].data == NULL)
+    return NULL;
+  return &FileViews[slot];
+}
+
+void file_map() {
+  struct stat info;
+  void *data;
+  CELL slot;
+  int fd;
+  char *request = string_extract(stack_pop());
+  for (slot = 1; slot < MAX_FILE_VIEWS && FileViews[slot].data; slot++)
+    ;
+  fd = (slot < MAX_FILE_VIEWS) ? open(request, O_RDONLY) : -1;
+  if (fd < 0) {
+    stack_push(0);
+    return;
+  }
+  data = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) &&
+      info.st_size > 0 && info.st_size <= CELL_MAX)
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    stack_push(0);
+    return;
+  }
+  FileViews[slot].data = data;
+  FileViews[slot].size = info.st_size;
+  stack_push(slot);
+}
+
+void file_unmap() {
+  struct FileView *view = file_view(stack_pop());
+  if (view) {
+    munmap(view->data, view->size);
+    view->data = NULL;
+    view->size = 0;
+  }
+}
+
+void view_size() {
+  struct FileView *view = file_view(stack_pop());
+  stack_push(view ? view->size : 0);
+}
+
+void view_fetch() {
+  struct FileView *view = file_view(stack_pop());
+  CELL offset = stack_pop();
+  if (view && offset >= 0 && offset < view->size) {
+    io_moved++;
+    stack_push(view->data[offset]);
+  } else {
+    stack_push(-1);
+  }
+}
+
+void view_index_of() {
+  struct FileView *view = file_view(stack_pop());
+  CELL offset = stack_pop();
+  CELL c = stack_pop();
+  unsigned char *found = NULL;
+  if (view && offset >= 0 && offset < view->size)
+    found = memchr(view->data + offset, c, view->size - offset);
+  stack_push(found ? (CELL)(found - view->data) : -1);
+}
+
+void view_search() {
+  struct FileView *view = file_view(stack_pop());
+  CELL offset = stack_pop();
+  char *wanted = string_extract(stack_pop());
+  CELL length = strlen(wanted);
+  unsigned char *at, *end;
+  if (!view || offset < 0 || offset > view->size) {
+    stack_push(-1);
+    return;
+  }
+  if (length == 0 || length > view->size - offset) {
+    stack_push(length == 0 ? offset : -1);
+    return;
+  }
+  end = view->data + view->size - length + 1;
+  for (at = view->data + offset; at < end; at++) {
+    at = memchr(at, wanted[0], end - at);
+    if (at == NULL)
+      break;
+    if (memcmp(at, wanted, length) == 0) {
+      stack_push(at - view->data);
+      return;
+    }
+  }
+  stack_push(-1);
+}
+
+void view_read_bytes() {
+  struct FileView *view = file_view(stack_pop());
+  CELL offset = stack_pop();
+  CELL n = stack_pop();
+  CELL at = stack_pop();
+  CELL i;
+  if (!view || offset < 0 || offset > view->size || n < 0 ||
+      at < 0 || at >= image_size) {
+    stack_push(0);
+    return;
+  }
+  if (n > view->size - offset)
+    n = view->size - offset;
+  if (n > image_size - at)
+    n = image_size - at;
+  for (i = 0; i < n; i++)
+    memory[at + i] = view->data[offset + i];
+  io_moved += n;
+  stack_push(n);
+}
+
+/* Reading a line copies up to the next CR, LF, or NUL into a string,
+   and returns the offset following it. */
+
+void view_read_line() {
+  struct FileView *view = file_view(stack_pop());
+  CELL at = stack_pop();
+  CELL offset = stack_pop();
+  unsigned char c;
+  if (!view || offset < 0 || at < 0 || at >= image_size) {
+    stack_push(offset);
+    return;
+  }
+  while (offset < view->size && at < image_size - 1) {
+    c = view->data[offset++];
+    if (c == 10 || c == 13 || c == 0)
+      break;
+    memory[at++] = c;
+    io_moved++;
+  }
+  memory[at] = 0;
+  stack_push(offset);
+}
+
+Handler FileActions[30] = {
   file_open,          file_close,
   file_read,          file_write,
   file_get_position,  file_set_position,
   file_get_size,      file_delete,
-  file_flush
+  file_flush,         file_read_bytes,
+  file_write_bytes,   file_read_packed,
+  file_write_packed,  file_map,
+  file_unmap,         view_size,
+  view_fetch,         view_index_of,
+  view_search,        view_read_bytes,
+  view_read_line,     file_next_line,
+  file_lines,         file_seek_line,
+  file_read_available, file_write_available,
+  file_pipe,          file_close_pipe,
+  file_truncate,      file_at_end
 };
 
 void query_filesystem() {
-  stack_push(0);
+  stack_push(5);
   stack_push(4);
 }
 
@@ -223,47 +693,69 @@ void unix_dir() {
   }
 }
 
-void unix_system() {
-  char *line, *args[128];
-  int i, status;
-  pid_t pid;
-
-  char **argv = args;
-  line = string_extract(stack_pop());
-
-  for(i = 0; i < 128; i++)
-    args[i] = 0;
-
-  while (*line != '\0') {
+/* Split a command line into arguments, in place. */
+int command_split(char *line, char **args) {
+  int argc = 0;
+  while (*line != '\0' && argc < 127) {
     while (*line == ' ' || *line == '\t' || *line == '\n')
       *line++ = '\0';
-    *argv++ = line;
+    args[argc++] = line;
     while (*line != '\0' && *line != ' ' && *line != '\t' && *line != '\n')
       line++;
   }
+  args[argc] = NULL;
+  return argc;
+}
+
+/* Run a command in a forked child. This doesn't return. */
+void command_exec(int argc, char **args) {
+  int e;
+  if (snapshot_matches(args))
+    snapshot_run(argc, args);
+  signal(SIGPIPE, SIG_DFL);
+  e = execvp(*args, args);
+  if (e < 0) {
+    printf("*** ERROR: exec failed with %d\n", e);
+    exit(1);
+  }
+}
+
+void unix_system() {
+  char *line, *args[128];
+  int argc, status;
+  pid_t pid;
+
+  line = string_extract(stack_pop());
+  argc = command_split(line, args);
 
+  fflush(NULL);
   if ((pid = fork()) < 0) {
     printf("*** ERROR: forking child process failed\n");
     exit(1);
   }
   else if (pid == 0) {
-    int e = execvp(*args, args);
-    if (e < 0) {
-      printf("*** ERROR: exec failed with %d\n", e);
-      exit(1);
-    }
+    command_exec(argc, args);
   } else {
-  while (wait(&status) != pid)
-    ;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+      ;
   }
 }
 
+/* Microseconds from a monotonic clock. This wraps around, so only the
+   difference between two readings is meaningful. */
+void unix_clock() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  stack_push((CELL)(uint32_t)(now.tv_sec * 1000000 + now.tv_nsec / 1000));
+}
+
 Handler UnixActions[] = {
-  unix_system, unix_dir
+  unix_system, unix_dir,
+  unix_clock
 };
 
 void query_unix() {
-  stack_push(1);
+  stack_push(2);
   stack_push(8);
 }
 
@@ -271,197 +763,2613 @@ void io_unix() {
   UnixActions[stack_pop()]();
 }
 
-void io_random() {
-  int64_t r = 0;
-  char buffer[8];
-  int i;
-  int fd = open("/dev/urandom", O_RDONLY);
-  read(fd, buffer, 8);
-  close(fd);
-  for(i = 0; i < 8; ++i) {
-    r = r << 8;
-    r += ((int64_t)buffer[i] & 0xFF);
-  }
-  stack_push(llabs(r));
-}
+/*---------------------------------------------------------------------
+  Events. Processes can be started without waiting for them, and a
+  set of file handles and processes watched with `poll()`. A process
+  is watched through a pidfd where the kernel has them, or by
+  checking it every 10ms otherwise.
 
-void query_rng() {
-  stack_push(0);
-  stack_push(10);
-}
+  Handle 0 is the standard input (or output, when writing).
+  ---------------------------------------------------------------------*/
 
-void io_output() {
-  putc(stack_pop(), stdout);
-  fflush(stdout);
+#define EVENT_READ   1
+#define EVENT_WRITE  2
+#define EVENT_EXIT   3
+
+VM_LOCAL struct Process {
+  pid_t pid;
+  int fd;                         /* pidfd, or -1                      */
+  int done;
+  CELL status;
+} Processes[MAX_PROCESSES];
+
+VM_LOCAL struct Watch {
+  CELL handle, kind;
+} Watches[MAX_WATCHES];
+VM_LOCAL int WatchCount, WatchNext;
+
+FILE *file_stream(CELL slot, int output) {
+  if (slot == 0)
+    return output ? stdout : stdin;
+  if (slot < 0 || slot >= MAX_OPEN_FILES)
+    return NULL;
+  return OpenFileHandles[slot];
 }
 
-void query_output() {
-  stack_push(0);
-  stack_push(0);
+/* True if a stream being read has data buffered, which `poll()` can't
+   see. This reads a character with the descriptor non-blocking and
+   puts it back, so it's also true if the descriptor has data waiting,
+   or is at the end. */
+int file_buffered(FILE *f) {
+  int c, fd, flags, ready;
+  if (!__freading(f))
+    return 0;
+  fd = fileno(f);
+  flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  c = getc(f);
+  fcntl(fd, F_SETFL, flags);
+  if (c != EOF)
+    return ungetc(c, f) != EOF;
+  ready = feof(f);
+  clearerr(f);
+  return ready;
 }
 
-void io_keyboard() {
-  stack_push(getc(stdin));
-  if (TOS == 127) TOS = 8;
+/* The non-blocking transfers move what they can without waiting, one
+   byte per cell, and return the number moved. Reading returns -1 at
+   the end of a file. */
+
+void file_read_available() {
+  FILE *f = file_stream(stack_pop(), 0);
+  CELL n = stack_pop();
+  CELL at = stack_pop();
+  CELL got = 0;
+  int c, fd, flags;
+  if (f == NULL) {
+    stack_push(-1);
+    return;
+  }
+  n = file_block_limit(at, n, 0);
+  fd = fileno(f);
+  flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  flockfile(f);
+  while (got < n && (c = getc_unlocked(f)) != EOF)
+    memory[at + got++] = c;
+  io_moved += got;
+  if (got == 0 && feof_unlocked(f))
+    got = -1;
+  clearerr_unlocked(f);
+  funlockfile(f);
+  fcntl(fd, F_SETFL, flags);
+  stack_push(got);
 }
 
-void query_keyboard() {
-  stack_push(0);
-  stack_push(1);
+void file_write_available() {
+  CELL slot = stack_pop();
+  FILE *f = file_stream(slot, 1);
+  CELL n = stack_pop();
+  CELL at = stack_pop();
+  CELL done = 0, want, i;
+  ssize_t put;
+  struct stat info;
+  int fd, flags, regular;
+  n = file_block_limit(at, n, 0);
+  if (f == NULL || fflush(f) != 0) {
+    stack_push(0);
+    return;
+  }
+  if (slot > 0)
+    file_forget_lines(slot);
+  fd = fileno(f);
+  regular = fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+  flags = fcntl(fd, F_GETFL);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  while (done < n) {
+    want = (n - done < (CELL)sizeof(file_block)) ? n - done : (CELL)sizeof(file_block);
+    for (i = 0; i < want; i++)
+      file_block[i] = (unsigned char)memory[at + done + i];
+    put = regular ? (ssize_t)fwrite(file_block, 1, want, f)
+                  : write(fd, file_block, want);
+    if (put <= 0)
+      break;
+    done += put;
+    if (put < want)
+      break;
+  }
+  fcntl(fd, F_SETFL, flags);
+  io_moved += done;
+  stack_push(done);
 }
 
-void scripting_arg() {
-  CELL a, b;
-  a = stack_pop();
-  b = stack_pop();
-  stack_push(string_inject(sys_argv[a + 2], b));
+/* A pipe runs a command with its standard output (for file:R), or
+   input (for file:W), connected to a new file handle. The parent's
+   end isn't inherited by other children, so they can't keep it open. */
+
+void file_pipe() {
+  CELL mode = stack_pop();
+  char *args[128];
+  char *line = string_extract(stack_pop());
+  int argc = command_split(line, args);
+  int fds[2], child = (mode == 0) ? 1 : 0;
+  CELL slot = files_get_handle();
+  pid_t pid;
+  if (slot == 0 || argc == 0 || (mode != 0 && mode != 1) || pipe(fds) < 0) {
+    stack_push(0);
+    return;
+  }
+  fflush(NULL);
+  if ((pid = fork()) < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    stack_push(0);
+    return;
+  }
+  if (pid == 0) {
+    dup2(fds[child], child);
+    close(fds[0]);
+    close(fds[1]);
+    command_exec(argc, args);
+  }
+  close(fds[child]);
+  fcntl(fds[1 - child], F_SETFD, FD_CLOEXEC);
+  OpenFileHandles[slot] = fdopen(fds[1 - child], (mode == 0) ? "r" : "w");
+  PipeChild[slot] = pid;
+  stack_push(slot);
 }
 
-void scripting_arg_count() {
-  stack_push(sys_argc - 2);
+void file_close_pipe() {
+  stack_push(file_close_slot(stack_pop()));
 }
 
-void scripting_include() {
-  include_file(string_extract(stack_pop()));
+void file_truncate() {
+  FILE *f = file_stream(stack_pop(), 1);
+  if (f != NULL && fflush(f) == 0)
+    ftruncate(fileno(f), ftell(f));
 }
 
-void scripting_name() {
-  stack_push(string_inject(sys_argv[1], stack_pop()));
+/* True if nothing more can be read. This waits for a character (on a
+   pipe, until the other end writes or closes it) and puts it back. */
+void file_at_end() {
+  FILE *f = file_stream(stack_pop(), 0);
+  int c;
+  if (f == NULL || (c = getc(f)) == EOF) {
+    if (f != NULL)
+      clearerr(f);
+    stack_push(-1);
+    return;
+  }
+  ungetc(c, f);
+  stack_push(0);
 }
 
-Handler ScriptingActions[] = {
-  scripting_arg_count,  scripting_arg,
-  scripting_include,    scripting_name,
-};
+struct Process *process_slot(CELL slot) {
+  if (slot <= 0 || slot >= MAX_PROCESSES || Processes[slot].pid == 0)
+    return NULL;
+  return &Processes[slot];
+}
 
-void query_scripting() {
-  stack_push(2);
-  stack_push(9);
+int process_reap(struct Process *p, int flags) {
+  int status;
+  pid_t r;
+  while (!p->done) {
+    r = waitpid(p->pid, &status, flags);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r == 0)
+      break;
+    p->done = 1;
+    p->status = (r < 0) ? -1 : exit_status(status);
+  }
+  return p->done;
 }
 
-void io_scripting() {
-  ScriptingActions[stack_pop()]();
+void process_forget(CELL slot) {
+  CELL i;
+  for (i = 0; i < WatchCount; i++)
+    if (Watches[i].kind == EVENT_EXIT && Watches[i].handle == slot)
+      Watches[i--] = Watches[--WatchCount];
+  if (Processes[slot].fd >= 0)
+    close(Processes[slot].fd);
+  memset(&Processes[slot], 0, sizeof(struct Process));
 }
 
-void execute(CELL cell) {
-  CELL a, b, i;
-  CELL opcode;
-  if (rp == 0) {
-    rp = 1;
+void process_spawn() {
+  char *line, *args[128];
+  int argc;
+  CELL slot;
+  pid_t pid;
+  line = string_extract(stack_pop());
+  argc = command_split(line, args);
+  for (slot = 1; slot < MAX_PROCESSES && Processes[slot].pid; slot++)
+    ;
+  if (argc == 0 || slot == MAX_PROCESSES) {
+    stack_push(0);
+    return;
   }
-  ip = cell;
-  while (ip < IMAGE_SIZE) {
-    opcode = memory[ip];
-    if (validate_opcode_bundle(opcode) != 0) {
-      process_opcode_bundle(opcode);
-    } else {
-      printf("\nERROR (nga/execute): Invalid instruction!\n");
-      printf("At %d, opcode %d\n", ip, opcode);
-      printf("Instructions: ");
-      a = opcode;
-      for (i = 0; i < 4; i++) {
-        b = a & 0xFF;
-        printf("%d ", b);
-        a = a >> 8;
-      }
-      printf("\n");
-      exit(1);
-    }
-    ip++;
-    if (rp == 0) {
-      ip = IMAGE_SIZE;
-    }
+  fflush(NULL);
+  if ((pid = fork()) < 0) {
+    stack_push(0);
+    return;
   }
+  if (pid == 0)
+    command_exec(argc, args);
+  Processes[slot].pid = pid;
+  Processes[slot].done = 0;
+#ifdef SYS_pidfd_open
+  Processes[slot].fd = syscall(SYS_pidfd_open, pid, 0);
+#else
+  Processes[slot].fd = -1;
+#endif
+  stack_push(slot);
 }
 
-void evaluate(char *s) {
-  if (strlen(s) == 0) return;
-  string_inject(s, TIB);
-  stack_push(TIB);
-  execute(interpret);
+void process_wait() {
+  CELL slot = stack_pop();
+  struct Process *p = process_slot(slot);
+  if (p == NULL) {
+    stack_push(-1);
+    return;
+  }
+  process_reap(p, 0);
+  stack_push(p->status);
+  process_forget(slot);
 }
 
-int not_eol(int c) {
-  return (c != 10) && (c != 13) && (c != 32) && (c != EOF) && (c != 0);
+void process_done() {
+  struct Process *p = process_slot(stack_pop());
+  stack_push((p == NULL || process_reap(p, WNOHANG)) ? -1 : 0);
 }
 
-void read_token(FILE *file, char *token_buffer, int echo) {
-  int ch = getc(file);
-  int count = 0;
-  if (echo != 0)
-    putchar(ch);
-  while (not_eol(ch)) {
-    if ((ch == 8 || ch == 127) && count > 0) {
-      count--;
-      if (echo != 0) {
-        putchar(8);
-        putchar(32);
-        putchar(8);
-      }
-    } else {
-      token_buffer[count++] = ch;
-    }
-    ch = getc(file);
-    if (echo != 0)
-      putchar(ch);
+void event_watch() {
+  CELL kind = stack_pop();
+  CELL handle = stack_pop();
+  CELL i;
+  for (i = 0; i < WatchCount; i++)
+    if (Watches[i].handle == handle && Watches[i].kind == kind)
+      return;
+  if (WatchCount < MAX_WATCHES && kind >= EVENT_READ && kind <= EVENT_EXIT) {
+    Watches[WatchCount].handle = handle;
+    Watches[WatchCount++].kind = kind;
   }
-  token_buffer[count] = '\0';
 }
 
-void dump_stack() {
+void event_forget() {
+  CELL kind = stack_pop();
+  CELL handle = stack_pop();
   CELL i;
-  if (sp == 0)  return;
-  printf("\nStack: ");
-  for (i = 1; i <= sp; i++) {
-    if (i == sp)
-      printf("[ TOS: %d ]", data[i]);
-    else
-      printf("%d ", data[i]);
-  }
-  printf("\n");
+  for (i = 0; i < WatchCount; i++)
+    if (Watches[i].handle == handle && Watches[i].kind == kind)
+      Watches[i--] = Watches[--WatchCount];
 }
 
-int fence_boundary(char *buffer) {
-  int flag = 1;
-  if (buffer[0] == '~' && buffer[1] == '~' && buffer[2] == '~') { flag = -1; }
-  return flag;
+long event_clock() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
 }
 
-void read_line(FILE *file, char *token_buffer) {
-  int ch = getc(file);
-  int count = 0;
-  while ((ch != 10) && (ch != 13) && (ch != EOF) && (ch != 0)) {
-    token_buffer[count++] = ch;
-    ch = getc(file);
+/* Returns the index of a watch that's ready now, filling in `fds` for
+   the rest. Watches on handles that aren't open are reported, so they
+   can be forgotten. */
+int event_scan(struct pollfd *fds, int *which, int *count, int *checking) {
+  struct Process *p;
+  struct Watch *w;
+  FILE *f;
+  int i, n;
+  *count = *checking = 0;
+  for (n = 0; n < WatchCount; n++) {
+    i = (WatchNext + n) % WatchCount;
+    w = &Watches[i];
+    if (w->kind == EVENT_EXIT) {
+      if ((p = process_slot(w->handle)) == NULL || p->done)
+        return i;
+      if (p->fd < 0) {
+        if (process_reap(p, WNOHANG))
+          return i;
+        *checking = 1;
+        continue;
+      }
+      fds[*count].fd = p->fd;
+      fds[*count].events = POLLIN;
+    } else {
+      if ((f = file_stream(w->handle, w->kind == EVENT_WRITE)) == NULL)
+        return i;
+      if (w->kind == EVENT_READ && file_buffered(f))
+        return i;
+      fds[*count].fd = fileno(f);
+      fds[*count].events = (w->kind == EVENT_READ) ? POLLIN : POLLOUT;
+    }
+    which[(*count)++] = i;
   }
-  token_buffer[count] = '\0';
+  return -1;
 }
 
-int count_tokens(char *line) {
-  char ch = line[0];
-  int count = 1;
-  while (*line++) {
-    ch = line[0];
-    if (isspace(ch))
-      count++;
+void event_wait() {
+  struct pollfd fds[MAX_WATCHES];
+  int which[MAX_WATCHES];
+  CELL timeout = stack_pop();
+  long deadline = event_clock() + timeout;
+  int ready = -1, count, checking, wait, i;
+  struct Watch w;
+  for (;;) {
+    if (WatchCount == 0)
+      break;
+    if ((ready = event_scan(fds, which, &count, &checking)) >= 0)
+      break;
+    wait = (timeout < 0) ? -1 : (int)(deadline - event_clock());
+    if (timeout >= 0 && wait < 0)
+      wait = 0;
+    if (checking && (wait < 0 || wait > 10))
+      wait = 10;
+    i = poll(fds, count, wait);
+    if (i > 0) {
+      for (i = 0; fds[i].revents == 0; i++)
+        ;
+      ready = which[i];
+      break;
+    }
+    if (i < 0 && errno != EINTR)
+      break;
+    if (i == 0 && timeout >= 0 && event_clock() >= deadline)
+      break;
   }
-  return count;
+  if (WatchCount == 0 || ready < 0) {
+    stack_push(0);
+    stack_push(0);
+    return;
+  }
+  w = Watches[ready];
+  WatchNext = ready + 1;
+  if (w.kind == EVENT_EXIT) {
+    Watches[ready] = Watches[--WatchCount];
+    if (process_slot(w.handle) != NULL)
+      process_reap(process_slot(w.handle), 0);
+  }
+  stack_push(w.handle);
+  stack_push(w.kind);
+}
+
+Handler EventActions[] = {
+  process_spawn,  process_wait,
+  process_done,   event_watch,
+  event_forget,   event_wait
+};
+
+void query_events() {
+  stack_push(0);
+  stack_push(17);
+}
+
+void io_events() {
+  EventActions[stack_pop()]();
+}
+
+void io_random() {
+  int64_t r = 0;
+  char buffer[8];
+  int i;
+  int fd = open("/dev/urandom", O_RDONLY);
+  read(fd, buffer, 8);
+  close(fd);
+  for(i = 0; i < 8; ++i) {
+    r = r << 8;
+    r += ((int64_t)buffer[i] & 0xFF);
+  }
+  stack_push(llabs(r));
+}
+
+void query_rng() {
+  stack_push(0);
+  stack_push(10);
+}
+
+/* Output is buffered: by line on a terminal, and fully when going
+   to a pipe or file. It's flushed before reading the keyboard, before
+   running a command, and on exit. */
+
+char output_buffer[64 * 1024];
+
+void output_prepare() {
+  setvbuf(stdout, output_buffer, isatty(fileno(stdout)) ? _IOLBF : _IOFBF,
+          sizeof(output_buffer));
+}
+
+/* SIGPIPE is ignored, so writing to a pipe whose reader has gone is
+   just a short write, and `pipe:close` can still return the command's
+   status. If it's the standard output that has gone, `rx` stops as it
+   would have on the signal. */
+void output_check(FILE *f) {
+  if (f == stdout && ferror(f) && errno == EPIPE) {
+    signal(SIGPIPE, SIG_DFL);
+    raise(SIGPIPE);
+  }
+}
+
+void io_output() {
+  FILE *f = output_stream();
+  putc(stack_pop(), f);
+  io_moved++;
+  output_check(f);
+}
+
+void query_output() {
+  stack_push(0);
+  stack_push(0);
+}
+
+void output_write() {
+  CELL at = stack_pop();
+  CELL start = at;
+  FILE *f = output_stream();
+  flockfile(f);
+  while (at >= 0 && at < image_size && memory[at] != 0)
+    putc_unlocked(memory[at++], f);
+  funlockfile(f);
+  io_moved += at - start;
+  output_check(f);
+}
+
+void output_flush() {
+  FILE *f = output_stream();
+  fflush(f);
+  output_check(f);
+}
+
+/* Redirecting output to a file handle (0 for standard output) saves
+   the current one, to be restored later. */
+
+void output_redirect() {
+  CELL slot = stack_pop();
+  if (OutputDepth == MAX_REDIRECTS)
+    return;
+  OutputStack[OutputDepth++] = Output;
+  if (slot == 0)
+    Output = NULL;
+  else if (slot > 0 && slot < MAX_OPEN_FILES && OpenFileHandles[slot])
+    Output = OpenFileHandles[slot];
+}
+
+void output_restore() {
+  if (OutputDepth > 0) {
+    fflush(output_stream());
+    Output = OutputStack[--OutputDepth];
+  }
+}
+
+Handler OutputActions[] = {
+  output_write,    output_flush,
+  output_redirect, output_restore
+};
+
+void query_output_actions() {
+  stack_push(0);
+  stack_push(11);
+}
+
+void io_output_actions() {
+  OutputActions[stack_pop()]();
+}
+
+void io_keyboard() {
+  fflush(stdout);
+  stack_push(getc(stdin));
+  if (TOS != EOF) io_moved++;
+  if (TOS == 127) TOS = 8;
+}
+
+void query_keyboard() {
+  stack_push(0);
+  stack_push(1);
+}
+
+/* Reading a line takes an address and a maximum length. Characters
+   are stored up to a CR or LF, with backspace (8) and DEL (127)
+   removing the previous one. Anything past the maximum length is
+   discarded. This returns the length, or -1 at the end of input. */
+
+char input_buffer[64 * 1024];
+
+void input_prepare() {
+  if (!isatty(fileno(stdin)))
+    setvbuf(stdin, input_buffer, _IOFBF, sizeof(input_buffer));
+}
+
+void input_read_line() {
+  CELL max, at, length = 0;
+  int c, valid;
+  max = stack_pop();
+  at = stack_pop();
+  valid = (at >= 0 && at < image_size);
+  if (!valid)
+    at = max = 0;
+  if (max < 0)
+    max = 0;
+  if (max > image_size - at - 1)
+    max = image_size - at - 1;
+  fflush(stdout);
+  while ((c = getc(stdin)) != EOF && c != 10 && c != 13) {
+    if (c == 8 || c == 127) {
+      if (length > 0) length--;
+    } else if (length < max) {
+      memory[at + length++] = c;
+    }
+  }
+  if (valid)
+    memory[at + length] = 0;
+  io_moved += length;
+  stack_push((c == EOF && length == 0) ? -1 : length);
+}
+
+Handler InputActions[] = {
+  input_read_line
+};
+
+void query_input_actions() {
+  stack_push(0);
+  stack_push(12);
+}
+
+void io_input_actions() {
+  InputActions[stack_pop()]();
+}
+
+/* String operations, done natively. Strings are zero terminated
+   arrays of cells; with SSE2 four cells are checked at a time. The
+   results match the Forth definitions in the kernel and standard
+   library, which remain in use when this device isn't present. */
+
+int strings_valid(CELL at) {
+  return at >= 0 && at < image_size;
+}
+
+CELL strings_length(CELL at) {
+  CELL i = at;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  int mask;
+  for (; i + 4 <= image_size; i += 4) {
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi32(
+             _mm_loadu_si128((__m128i *)(memory + i)), zero));
+    if (mask)
+      return i - at + (__builtin_ctz(mask) >> 2);
+  }
+#endif
+  while (i < image_size && memory[i] != 0)
+    i++;
+  return i - at;
+}
+
+CELL strings_index_of(CELL at, CELL value) {
+  CELL i = at;
+  if (value == 0)
+    return -1;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i wanted = _mm_set1_epi32(value);
+  __m128i block;
+  int mask, end;
+  for (; i + 4 <= image_size; i += 4) {
+    block = _mm_loadu_si128((__m128i *)(memory + i));
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi32(block, wanted));
+    end = _mm_movemask_epi8(_mm_cmpeq_epi32(block, zero));
+    if (mask && (!end || __builtin_ctz(mask) < __builtin_ctz(end)))
+      return i - at + (__builtin_ctz(mask) >> 2);
+    if (end)
+      return -1;
+  }
+#endif
+  for (; i < image_size && memory[i] != 0; i++)
+    if (memory[i] == value)
+      return i - at;
+  return -1;
+}
+
+void strings_length_of() {
+  CELL at = stack_pop();
+  stack_push(strings_valid(at) ? strings_length(at) : 0);
+}
+
+void strings_equal() {
+  CELL a = stack_pop();
+  CELL b = stack_pop();
+  if (!strings_valid(a) || !strings_valid(b)) {
+    stack_push(0);
+    return;
+  }
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i x;
+  int diff, end;
+  for (; a + 4 <= image_size && b + 4 <= image_size; a += 4, b += 4) {
+    x = _mm_loadu_si128((__m128i *)(memory + a));
+    diff = ~_mm_movemask_epi8(_mm_cmpeq_epi32(x,
+             _mm_loadu_si128((__m128i *)(memory + b)))) & 0xFFFF;
+    end = _mm_movemask_epi8(_mm_cmpeq_epi32(x, zero));
+    if (diff && (!end || __builtin_ctz(diff) <= __builtin_ctz(end))) {
+      stack_push(0);
+      return;
+    }
+    if (end) {
+      stack_push(-1);
+      return;
+    }
+  }
+#endif
+  for (; a < image_size && b < image_size; a++, b++) {
+    if (memory[a] != memory[b])
+      break;
+    if (memory[a] == 0) {
+      stack_push(-1);
+      return;
+    }
+  }
+  stack_push(0);
+}
+
+void strings_index() {
+  CELL value = stack_pop();
+  CELL at = stack_pop();
+  stack_push(strings_valid(at) ? strings_index_of(at, value) : -1);
+}
+
+void strings_contains() {
+  CELL wanted = stack_pop();
+  CELL at = stack_pop();
+  CELL length, i = -1;
+  if (!strings_valid(at) || !strings_valid(wanted) || memory[at] == 0) {
+    stack_push(0);
+    return;
+  }
+  length = strings_length(wanted);
+  while (length > 0 && (i = strings_index_of(at, memory[wanted])) >= 0) {
+    at += i;
+    if (at + length <= image_size &&
+        memcmp(memory + at, memory + wanted, length * sizeof(CELL)) == 0)
+      break;
+    at++;
+  }
+  stack_push((length == 0 || i >= 0) ? -1 : 0);
+}
+
+void strings_hash() {
+  CELL at = stack_pop();
+  uint32_t hash = 5381;
+  while (strings_valid(at) && memory[at] != 0)
+    hash = hash * 33 + (uint32_t)memory[at++];
+  stack_push((CELL)hash);
+}
+
+void strings_copy() {
+  CELL length = stack_pop();
+  CELL to = stack_pop();
+  CELL from = stack_pop();
+  if (length <= 0 || !strings_valid(from) || !strings_valid(to) ||
+      length > image_size - from || length > image_size - to)
+    return;
+  if (to > from && to < from + length)
+    while (length--)
+      memory[to++] = memory[from++];
+  else
+    memmove(memory + to, memory + from, length * sizeof(CELL));
+}
+
+Handler StringActions[] = {
+  strings_length_of, strings_equal, strings_index,
+  strings_contains,  strings_hash,  strings_copy
+};
+
+void query_strings() {
+  stack_push(0);
+  stack_push(13);
+}
+
+void io_strings() {
+  StringActions[stack_pop()]();
+}
+
+/* Packed strings keep four characters per cell, in the little endian
+   order used by `file:read-packed`. They're addressed by byte: a cell
+   address times four, plus the offset in the cell. On little endian
+   hosts this is also the layout of `memory`, so the C library string
+   functions can be used directly. */
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PACKED_NATIVE_ORDER
+#endif
+
+#define PACKED_BYTES (image_size * 4)
+
+int packed_valid(CELL at) {
+  return at >= 0 && at < PACKED_BYTES;
+}
+
+CELL packed_fetch_byte(CELL at) {
+#if defined(PACKED_NATIVE_ORDER)
+  return ((unsigned char *)memory)[at];
+#else
+  return ((uint32_t)memory[at / 4] >> ((at & 3) * 8)) & 0xFF;
+#endif
+}
+
+void packed_store_byte(CELL at, CELL c) {
+#if defined(PACKED_NATIVE_ORDER)
+  ((unsigned char *)memory)[at] = (unsigned char)c;
+#else
+  uint32_t shift = (at & 3) * 8;
+  memory[at / 4] = (CELL)(((uint32_t)memory[at / 4] & ~(0xFFu << shift)) |
+                          (((uint32_t)c & 0xFF) << shift));
+#endif
+}
+
+CELL packed_length_of(CELL at) {
+#if defined(PACKED_NATIVE_ORDER)
+  return strnlen((char *)memory + at, PACKED_BYTES - at);
+#else
+  CELL i = at;
+  while (i < PACKED_BYTES && packed_fetch_byte(i) != 0)
+    i++;
+  return i - at;
+#endif
+}
+
+CELL packed_find(CELL at, CELL length, CELL c) {
+#if defined(PACKED_NATIVE_ORDER)
+  unsigned char *p = memchr((unsigned char *)memory + at, c, length);
+  return p ? (CELL)(p - ((unsigned char *)memory + at)) : -1;
+#else
+  CELL i;
+  for (i = 0; i < length; i++)
+    if (packed_fetch_byte(at + i) == c)
+      return i;
+  return -1;
+#endif
+}
+
+int packed_matches(CELL a, CELL b, CELL length) {
+#if defined(PACKED_NATIVE_ORDER)
+  return memcmp((char *)memory + a, (char *)memory + b, length) == 0;
+#else
+  CELL i;
+  for (i = 0; i < length; i++)
+    if (packed_fetch_byte(a + i) != packed_fetch_byte(b + i))
+      return 0;
+  return 1;
+#endif
+}
+
+void packed_move(CELL from, CELL to, CELL length) {
+#if defined(PACKED_NATIVE_ORDER)
+  memmove((char *)memory + to, (char *)memory + from, length);
+#else
+  CELL i;
+  if (to > from)
+    for (i = length - 1; i >= 0; i--)
+      packed_store_byte(to + i, packed_fetch_byte(from + i));
+  else
+    for (i = 0; i < length; i++)
+      packed_store_byte(to + i, packed_fetch_byte(from + i));
+#endif
+}
+
+void packed_fetch() {
+  CELL at = stack_pop();
+  stack_push(packed_valid(at) ? packed_fetch_byte(at) : 0);
+}
+
+void packed_store() {
+  CELL at = stack_pop();
+  CELL c = stack_pop();
+  if (packed_valid(at))
+    packed_store_byte(at, c);
+}
+
+void packed_length() {
+  CELL at = stack_pop();
+  stack_push(packed_valid(at) ? packed_length_of(at) : 0);
+}
+
+void packed_equal() {
+  CELL a = stack_pop();
+  CELL b = stack_pop();
+  CELL length;
+  if (!packed_valid(a) || !packed_valid(b)) {
+    stack_push(0);
+    return;
+  }
+  length = packed_length_of(a);
+  stack_push((packed_length_of(b) == length &&
+              packed_matches(a, b, length)) ? -1 : 0);
+}
+
+void packed_index_of() {
+  CELL c = stack_pop() & 0xFF;
+  CELL at = stack_pop();
+  if (!packed_valid(at) || c == 0) {
+    stack_push(-1);
+    return;
+  }
+  stack_push(packed_find(at, packed_length_of(at), c));
+}
+
+void packed_search() {
+  CELL wanted = stack_pop();
+  CELL at = stack_pop();
+  CELL length, needle, i, found = -1;
+  if (!packed_valid(at) || !packed_valid(wanted)) {
+    stack_push(-1);
+    return;
+  }
+  length = packed_length_of(at);
+  needle = packed_length_of(wanted);
+  if (needle == 0) {
+    stack_push(0);
+    return;
+  }
+  for (i = 0; i + needle <= length; i++) {
+    CELL next = packed_find(at + i, length - needle - i + 1,
+                            packed_fetch_byte(wanted));
+    if (next < 0)
+      break;
+    i += next;
+    if (packed_matches(at + i, wanted, needle)) {
+      found = i;
+      break;
+    }
+  }
+  stack_push(found);
+}
+
+void packed_copy() {
+  CELL length = stack_pop();
+  CELL to = stack_pop();
+  CELL from = stack_pop();
+  if (length <= 0 || !packed_valid(from) || !packed_valid(to) ||
+      length > PACKED_BYTES - from || length > PACKED_BYTES - to)
+    return;
+  packed_move(from, to, length);
+}
+
+void packed_slice() {
+  CELL to = stack_pop();
+  CELL length = stack_pop();
+  CELL start = stack_pop();
+  CELL from = stack_pop() + start;
+  if (length < 0 || !packed_valid(from) || !packed_valid(to) ||
+      length > PACKED_BYTES - from || length >= PACKED_BYTES - to)
+    return;
+  packed_move(from, to, length);
+  packed_store_byte(to + length, 0);
+}
+
+void packed_pack() {
+  CELL to = stack_pop();
+  CELL from = stack_pop();
+  if (!strings_valid(from) || !packed_valid(to))
+    return;
+  for (; to < PACKED_BYTES - 1 && from < image_size && memory[from] != 0; to++)
+    packed_store_byte(to, memory[from++]);
+  packed_store_byte(to, 0);
+}
+
+void packed_unpack() {
+  CELL to = stack_pop();
+  CELL from = stack_pop();
+  if (!packed_valid(from) || !strings_valid(to))
+    return;
+  for (; to < image_size - 1 && from < PACKED_BYTES; to++, from++)
+    if ((memory[to] = packed_fetch_byte(from)) == 0)
+      return;
+  memory[to] = 0;
+}
+
+Handler PackedActions[] = {
+  packed_fetch,     packed_store,
+  packed_length,    packed_equal,
+  packed_index_of,  packed_search,
+  packed_copy,      packed_slice,
+  packed_pack,      packed_unpack
+};
+
+void query_packed() {
+  stack_push(0);
+  stack_push(14);
+}
+
+void io_packed() {
+  PackedActions[stack_pop()]();
+}
+
+/* Directories are read an entry at a time. If the last part of the
+   path given to `dir_open()` contains a `*`, `?` or `[`, it's taken
+   as a pattern, and only the entries matching it are returned. The
+   type, size, and modification time of the current entry are found
+   from `d_type`, or with `fstatat()` on the open directory, so files
+   aren't opened to get them. Slot 0 is never used. */
+
+VM_LOCAL struct OpenDir {
+  DIR *dir;
+  struct dirent *entry;
+  struct stat info;
+  int stated;
+  char pattern[NAME_MAX + 1];
+} OpenDirs[MAX_OPEN_DIRS];
+
+struct OpenDir *dir_slot(CELL slot) {
+  if (slot <= 0 || slot >= MAX_OPEN_DIRS || OpenDirs[slot].dir == NULL)
+    return NULL;
+  return &OpenDirs[slot];
+}
+
+int dir_stat(struct OpenDir *d) {
+  if (d->entry == NULL)
+    return 0;
+  if (!d->stated)
+    d->stated = fstatat(dirfd(d->dir), d->entry->d_name, &d->info, 0) == 0;
+  return d->stated;
+}
+
+void dir_open() {
+  CELL slot;
+  char *path = string_extract(stack_pop());
+  char *last = strrchr(path, '/');
+  char *name = last ? last + 1 : path;
+  struct OpenDir *d;
+  for (slot = 1; slot < MAX_OPEN_DIRS && OpenDirs[slot].dir; slot++)
+    ;
+  if (slot == MAX_OPEN_DIRS) {
+    stack_push(0);
+    return;
+  }
+  d = &OpenDirs[slot];
+  d->pattern[0] = '\0';
+  if (strpbrk(name, "*?[") && strlen(name) <= NAME_MAX) {
+    strcpy(d->pattern, name);
+    if (last == path)
+      path = "/";
+    else if (last)
+      *last = '\0';
+    else
+      path = ".";
+  }
+  d->dir = opendir(path[0] ? path : ".");
+  d->entry = NULL;
+  d->stated = 0;
+  stack_push(d->dir ? slot : 0);
+}
+
+void dir_close() {
+  struct OpenDir *d = dir_slot(stack_pop());
+  if (d == NULL)
+    return;
+  closedir(d->dir);
+  d->dir = NULL;
+  d->entry = NULL;
+}
+
+void dir_next() {
+  struct OpenDir *d = dir_slot(stack_pop());
+  CELL to = stack_pop();
+  char *name;
+  if (d == NULL || !strings_valid(to)) {
+    stack_push(0);
+    return;
+  }
+  d->stated = 0;
+  while ((d->entry = readdir(d->dir)) != NULL) {
+    name = d->entry->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+      continue;
+    if (d->pattern[0] && fnmatch(d->pattern, name, 0) != 0)
+      continue;
+    if ((CELL)strlen(name) >= image_size - to)
+      continue;
+    string_inject(name, to);
+    stack_push(-1);
+    return;
+  }
+  memory[to] = 0;
+  stack_push(0);
+}
+
+void dir_type() {
+  struct OpenDir *d = dir_slot(stack_pop());
+  if (d == NULL || d->entry == NULL) {
+    stack_push(-1);
+    return;
+  }
+  switch (d->entry->d_type) {
+    case DT_REG: stack_push(0); return;
+    case DT_DIR: stack_push(1); return;
+    case DT_LNK:
+    case DT_UNKNOWN: break;
+    default:     stack_push(2); return;
+  }
+  if (!dir_stat(d))
+    stack_push(-1);
+  else if (S_ISREG(d->info.st_mode))
+    stack_push(0);
+  else if (S_ISDIR(d->info.st_mode))
+    stack_push(1);
+  else
+    stack_push(2);
+}
+
+void dir_size() {
+  struct OpenDir *d = dir_slot(stack_pop());
+  if (d == NULL || !dir_stat(d))
+    stack_push(-1);
+  else
+    stack_push(d->info.st_size > CELL_MAX ? CELL_MAX : (CELL)d->info.st_size);
+}
+
+void dir_mtime() {
+  struct OpenDir *d = dir_slot(stack_pop());
+  if (d == NULL || !dir_stat(d))
+    stack_push(-1);
+  else
+    stack_push((CELL)d->info.st_mtime);
+}
+
+Handler DirActions[] = {
+  dir_open,  dir_close,
+  dir_next,  dir_type,
+  dir_size,  dir_mtime
+};
+
+void query_dirs() {
+  stack_push(0);
+  stack_push(15);
+}
+
+void io_dirs() {
+  DirActions[stack_pop()]();
+}
+
+void scripting_arg() {
+  CELL a, b;
+  a = stack_pop();
+  b = stack_pop();
+  stack_push(string_inject(sys_argv[a + 2], b));
+}
+
+void scripting_arg_count() {
+  stack_push(sys_argc - 2);
+}
+
+void scripting_include() {
+  include_file(string_extract(stack_pop()));
+}
+
+void scripting_name() {
+  stack_push(string_inject(sys_argv[1], stack_pop()));
+}
+
+void scripting_save_image() {
+  image_save(string_extract(stack_pop()), 0);
+}
+
+void scripting_save_tool() {
+  CELL entry = stack_pop();
+  image_save(string_extract(stack_pop()), entry);
+}
+
+Handler ScriptingActions[] = {
+  scripting_arg_count,  scripting_arg,
+  scripting_include,    scripting_name,
+  scripting_save_image, scripting_save_tool,
+};
+
+void query_scripting() {
+  stack_push(4);
+  stack_push(9);
+}
+
+void io_scripting() {
+  ScriptingActions[stack_pop()]();
+}
+
+/*---------------------------------------------------------------------
+  I/O statistics. When these are on, each `ii` and `iq` is counted by
+  device and action, with the bytes it moved and the time it took.
+  The action is the value on the stack when `ii` runs, for devices
+  with an action table; queries are counted as action -1. Bucket `b`
+  of the latency histogram holds calls that took from 2^b up to
+  2^(b+1) nanoseconds. A call that runs others (like including a
+  file) is counted along with the time and bytes of those.
+
+  Set RX_IO_STATS to a file name, or `-` for standard error, to turn
+  them on and have them appended there at exit. The stats device can
+  also turn them on, and read or write them out.
+  ---------------------------------------------------------------------*/
+
+#define IO_ACTIONS  32
+#define IO_BUCKETS  32
+
+#define ACTIONS(table)  (int)(sizeof(table) / sizeof(Handler))
+
+struct IoStat {
+  uint64_t calls, bytes, nanoseconds;
+  uint64_t buckets[IO_BUCKETS];
+} IoStats[MAX_DEVICES][IO_ACTIONS + 1];   /* The last is for queries */
+
+int IoStatsOn;
+
+uint64_t io_clock() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void io_measured(CELL device, int query) {
+  struct IoStat *stat;
+  uint64_t start, ns, moved = io_moved;
+  int action = IO_ACTIONS, bucket = 0;
+  if (device < 0 || device >= devices) {
+    (query ? IO_queryHandlers : IO_deviceHandlers)[device]();
+    return;
+  }
+  if (!query)
+    action = (IO_deviceActions[device] > 0 && TOS >= 0 && TOS < IO_ACTIONS) ? TOS : 0;
+  start = io_clock();
+  (query ? IO_queryHandlers : IO_deviceHandlers)[device]();
+  ns = io_clock() - start;
+  while (bucket < IO_BUCKETS - 1 && (ns >> (bucket + 1)) != 0)
+    bucket++;
+  stat = &IoStats[device][action];
+  __atomic_add_fetch(&stat->calls, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stat->bytes, io_moved - moved, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stat->nanoseconds, ns, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&stat->buckets[bucket], 1, __ATOMIC_RELAXED);
+}
+
+/* One line per device and action used: the device name, action (or
+   `query`), calls, bytes, total nanoseconds, and `bucket:count` for
+   each bucket of the histogram that isn't empty. */
+void io_stats_write(FILE *f) {
+  struct IoStat *stat;
+  int d, a, b;
+  fprintf(f, "device\taction\tcalls\tbytes\tns\tlatency\n");
+  for (d = 0; d < devices; d++)
+    for (a = 0; a <= IO_ACTIONS; a++) {
+      stat = &IoStats[d][a];
+      if (stat->calls == 0)
+        continue;
+      fprintf(f, "%s\t", IO_deviceNames[d]);
+      if (a == IO_ACTIONS)
+        fprintf(f, "query");
+      else
+        fprintf(f, "%d", a);
+      fprintf(f, "\t%llu\t%llu\t%llu\t", (unsigned long long)stat->calls,
+              (unsigned long long)stat->bytes,
+              (unsigned long long)stat->nanoseconds);
+      for (b = 0; b < IO_BUCKETS; b++)
+        if (stat->buckets[b] != 0)
+          fprintf(f, "%d:%llu ", b, (unsigned long long)stat->buckets[b]);
+      fprintf(f, "\n");
+    }
+}
+
+void io_stats_save() {
+  char *name = getenv("RX_IO_STATS");
+  FILE *f;
+  if (name == NULL)
+    return;
+  if (strcmp(name, "-") == 0)
+    f = stderr;
+  else if ((f = fopen(name, "a")) == NULL)
+    return;
+  io_stats_write(f);
+  if (f != stderr)
+    fclose(f);
+}
+
+void io_stats_prepare() {
+  if (getenv("RX_IO_STATS") == NULL)
+    return;
+  IoStatsOn = 1;
+  atexit(io_stats_save);
+}
+
+struct IoStat *stats_entry() {
+  CELL action = stack_pop();
+  CELL device = stack_pop();
+  if (device < 0 || device >= devices || action < -1 || action >= IO_ACTIONS)
+    return NULL;
+  return &IoStats[device][(action < 0) ? IO_ACTIONS : action];
+}
+
+CELL stats_value(struct IoStat *stat, uint64_t value) {
+  if (stat == NULL)
+    return 0;
+  return (value > CELL_MAX) ? CELL_MAX : (CELL)value;
+}
+
+void stats_on()    { IoStatsOn = 1; }
+void stats_off()   { IoStatsOn = 0; }
+void stats_reset() { memset(IoStats, 0, sizeof(IoStats)); }
+
+void stats_calls() {
+  struct IoStat *stat = stats_entry();
+  stack_push(stats_value(stat, stat ? stat->calls : 0));
+}
+
+void stats_bytes() {
+  struct IoStat *stat = stats_entry();
+  stack_push(stats_value(stat, stat ? stat->bytes : 0));
+}
+
+/* Total time, in microseconds */
+void stats_time() {
+  struct IoStat *stat = stats_entry();
+  stack_push(stats_value(stat, stat ? stat->nanoseconds / 1000 : 0));
+}
+
+void stats_bucket() {
+  CELL bucket = stack_pop();
+  struct IoStat *stat = stats_entry();
+  if (bucket < 0 || bucket >= IO_BUCKETS)
+    stat = NULL;
+  stack_push(stats_value(stat, stat ? stat->buckets[bucket] : 0));
+}
+
+void stats_dump() {
+  io_stats_write(output_stream());
+}
+
+Handler StatsActions[] = {
+  stats_on,     stats_off,
+  stats_reset,  stats_calls,
+  stats_bytes,  stats_time,
+  stats_bucket, stats_dump
+};
+
+void query_stats() {
+  stack_push(0);
+  stack_push(18);
+}
+
+void io_stats() {
+  StatsActions[stack_pop()]();
+}
+
+void invalid_bundle(CELL at, CELL opcode) {
+  CELL a, b, i;
+  printf("\nERROR (nga/execute): Invalid instruction!\n");
+  printf("At %d, opcode %d\n", at, opcode);
+  printf("Instructions: ");
+  a = opcode;
+  for (i = 0; i < 4; i++) {
+    b = a & 0xFF;
+    printf("%d ", b);
+    a = a >> 8;
+  }
+  printf("\n");
+  exit(1);
+}
+
+/* A bundle is valid when all four bytes are in the 0 - 29 range. */
+#define BUNDLE_VALID(x)  ((((x) & 0x80808080) | \
+                          ((((x) & 0x7F7F7F7F) + 0x62626262) & 0x80808080)) == 0)
+
+/*---------------------------------------------------------------------
+  A sampling profiler. Set RX_PROFILE to the name of a file and the VM
+  is interrupted RX_PROFILE_HZ times (1000 by default, or as often as
+  the kernel's timer allows) per second of CPU time. At the next
+  bundle it notes the word running, and the words on the address
+  stack that led to it. Each is found by walking
+  the Dictionary for the nearest preceding xt, so code in a quote is
+  counted as part of the word it's in. At exit, these are appended to
+  the file as folded stacks, for flame graph tools:
+
+      interpret;class:word;s:for-each;call 42
+
+  A `;` in a name is written as `_`.
+
+  Set RX_PROFILE_CALLS to the name of another file to count the times
+  each word is called. This is exact, and is appended as `name<tab>
+  count` lines. Jumps into a word (which the kernel uses for some tail
+  calls) aren't counted, nor are calls made by jobs.
+
+  Samples are taken between bundles, by `execute()`. A translated
+  block doesn't go on to the next one while a sample is due, so the
+  JIT stays on. Translated calls aren't counted, so it is turned off
+  when counting calls.
+  ---------------------------------------------------------------------*/
+
+#define PROFILER_NAME  64           /* Longest name kept for a frame     */
+
+#define PROFILER_ENTER(calls, x) \
+  if ((calls) != NULL && (uint32_t)(x) <= (uint32_t)image_size) (calls)[x]++
+
+struct ProfilerWord {
+  CELL xt, header;
+};
+
+struct ProfilerCount {
+  char *name;
+  unsigned long hash;
+  long count;
+};
+
+struct ProfilerTable {
+  struct ProfilerCount *slots;
+  long size, used;
+};
+
+VM_LOCAL volatile sig_atomic_t profiler_due;
+VM_LOCAL uint64_t *profiler_calls;    /* Entries by address; main VM only */
+VM_LOCAL CELL profiler_root;          /* Where `execute()` was started    */
+VM_LOCAL struct ProfilerWord *ProfilerWords;  /* Headers, sorted by xt  */
+VM_LOCAL CELL ProfilerWordCount, ProfilerWordRoom, ProfilerLatest;
+VM_LOCAL CELL ProfilerDataClass;
+VM_LOCAL char profiler_line[(ADDRESSES + 1) * (PROFILER_NAME + 1) + 8];
+
+int ProfilerOn;
+long ProfilerInterval;
+uint64_t *ProfilerCalls;
+struct ProfilerTable ProfilerStacks;
+pthread_mutex_t ProfilerLock = PTHREAD_MUTEX_INITIALIZER;
+
+void profiler_tick(int sig) {
+  (void)sig;
+  profiler_due = 1;
+}
+
+/* The table of headers is kept up to date by walking the Dictionary
+   from the newest header to the newest one seen before. If that's no
+   longer there, it is rebuilt. Constants and variables are left out,
+   as their xt isn't code. */
+void profiler_add_word(CELL header) {
+  struct ProfilerWord *more;
+  CELL xt = memory[header + D_OFFSET_XT];
+  CELL at = ProfilerWordCount;
+  if (memory[header + D_OFFSET_CLASS] == ProfilerDataClass)
+    return;
+  if (ProfilerWordCount == ProfilerWordRoom) {
+    more = realloc(ProfilerWords, (ProfilerWordRoom + 1024) * sizeof(struct ProfilerWord));
+    if (more == NULL) return;
+    ProfilerWords = more;
+    ProfilerWordRoom += 1024;
+  }
+  for (; at > 0 && ProfilerWords[at - 1].xt > xt; at--)
+    ProfilerWords[at] = ProfilerWords[at - 1];
+  ProfilerWords[at].xt = xt;
+  ProfilerWords[at].header = header;
+  ProfilerWordCount++;
+}
+
+int profiler_header(CELL at) {
+  return at > 0 && at < image_size - PROFILER_NAME;
+}
+
+void profiler_update_words() {
+  CELL at, latest = memory[2];
+  if (latest == ProfilerLatest)
+    return;
+  for (at = latest; profiler_header(at) && at != ProfilerLatest; at = memory[at])
+    ;
+  if (at != ProfilerLatest || ProfilerLatest == 0) {
+    ProfilerWordCount = ProfilerLatest = 0;
+    ProfilerDataClass = d_xt_for("class:data", latest);
+  }
+  for (at = latest; profiler_header(at) && at != ProfilerLatest; at = memory[at])
+    profiler_add_word(at);
+  ProfilerLatest = latest;
+}
+
+/* Returns the header with the nearest xt at or before an address, or
+   0 if there is none. */
+CELL profiler_word(CELL at) {
+  CELL low = 0, high = ProfilerWordCount, middle;
+  while (low < high) {
+    middle = (low + high) / 2;
+    if (ProfilerWords[middle].xt <= at)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return (low == 0) ? 0 : ProfilerWords[low - 1].header;
+}
+
+char *profiler_name(char *to, CELL header) {
+  CELL at, c;
+  if (header == 0) {
+    *to++ = '?';
+    return to;
+  }
+  for (at = header + D_OFFSET_NAME; at < header + D_OFFSET_NAME + PROFILER_NAME; at++) {
+    if ((c = memory[at]) == 0)
+      break;
+    *to++ = (c == ';' || c <= ' ' || c > '~') ? '_' : c;
+  }
+  return to;
+}
+
+unsigned long profiler_hash(char *s) {
+  unsigned long h = 2166136261u;
+  while (*s)
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h;
+}
+
+/* These are called with ProfilerLock held. */
+void profiler_grow(struct ProfilerTable *t) {
+  struct ProfilerTable bigger;
+  long i, at;
+  bigger.size = t->size ? t->size * 2 : 4096;
+  bigger.used = t->used;
+  if ((bigger.slots = calloc(bigger.size, sizeof(struct ProfilerCount))) == NULL)
+    return;
+  for (i = 0; i < t->size; i++) {
+    if (t->slots[i].name == NULL)
+      continue;
+    for (at = t->slots[i].hash & (bigger.size - 1); bigger.slots[at].name; )
+      at = (at + 1) & (bigger.size - 1);
+    bigger.slots[at] = t->slots[i];
+  }
+  free(t->slots);
+  *t = bigger;
+}
+
+void profiler_count(struct ProfilerTable *t, char *name, long n) {
+  unsigned long h = profiler_hash(name);
+  long at;
+  if (t->used * 2 >= t->size)
+    profiler_grow(t);
+  if (t->used * 2 >= t->size)
+    return;
+  for (at = h & (t->size - 1); t->slots[at].name; at = (at + 1) & (t->size - 1))
+    if (t->slots[at].hash == h && strcmp(t->slots[at].name, name) == 0) {
+      t->slots[at].count += n;
+      return;
+    }
+  if ((t->slots[at].name = strdup(name)) == NULL)
+    return;
+  t->slots[at].hash = h;
+  t->slots[at].count = n;
+  t->used++;
+}
+
+void profiler_clear(struct ProfilerTable *t) {
+  long i;
+  for (i = 0; i < t->size; i++)
+    free(t->slots[i].name);
+  free(t->slots);
+  memset(t, 0, sizeof(struct ProfilerTable));
+}
+
+/* Returns the number of `li` before a call that ends a bundle, or -1
+   if it doesn't end with one or isn't valid. */
+int profiler_literals(CELL bundle) {
+  int literals = 0;
+  if (!BUNDLE_VALID(bundle))
+    return -1;
+  for (; bundle != 0; bundle = (CELL)((uint32_t)bundle >> 8)) {
+    if ((bundle & 0xFF) == 8 || (bundle & 0xFF) == 9)
+      return ((uint32_t)bundle >> 8) == 0 ? literals : -1;
+    literals += ((bundle & 0xFF) == 1);
+  }
+  return -1;
+}
+
+/* A call through `lica` leaves the address of its literal, which is
+   the xt of the word called: the one `inner` (the next frame in) is
+   running. Other calls leave the address of the bundle with the call,
+   which can't be checked further. Anything else on the address stack
+   (values put there with `push`, like the counter in `times`) is
+   skipped. */
+int profiler_returns_to(CELL at, CELL inner) {
+  if (at < 1 || at >= memory[3])
+    return 0;
+  if (profiler_literals(memory[at - 1]) == 1)
+    return profiler_word(memory[at]) == inner && inner != 0;
+  return profiler_literals(memory[at]) == 0;
+}
+
+/* The frames are found from the innermost out, as each is checked
+   against the one inside it. */
+void profiler_sample() {
+  char *to = profiler_line;
+  CELL frames[ADDRESSES + 1];
+  CELL i, count = 0;
+  profiler_due = 0;
+  profiler_update_words();
+  frames[count++] = profiler_word(ip);
+  for (i = (rp < ADDRESSES) ? rp : ADDRESSES - 1; i >= 2; i--)
+    if (profiler_returns_to(address[i], frames[count - 1]))
+      frames[count++] = profiler_word(address[i]);
+  if (profiler_root > 0) {
+    to = profiler_name(to, profiler_word(profiler_root));
+    *to++ = ';';
+  }
+  while (count > 1) {
+    to = profiler_name(to, frames[--count]);
+    *to++ = ';';
+  }
+  to = profiler_name(to, frames[0]);
+  *to = 0;
+  pthread_mutex_lock(&ProfilerLock);
+  profiler_count(&ProfilerStacks, profiler_line, 1);
+  pthread_mutex_unlock(&ProfilerLock);
+}
+
+int profiler_compare(const void *a, const void *b) {
+  long x = ((struct ProfilerCount *)a)->count;
+  long y = ((struct ProfilerCount *)b)->count;
+  return (x < y) - (x > y);
+}
+
+void profiler_write(struct ProfilerTable *t, char *name, char separator) {
+  FILE *fp;
+  long i;
+  if (name == NULL || t->used == 0 || (fp = fopen(name, "a")) == NULL)
+    return;
+  qsort(t->slots, t->size, sizeof(struct ProfilerCount), profiler_compare);
+  for (i = 0; i < t->size && t->slots[i].count != 0; i++)
+    fprintf(fp, "%s%c%ld\n", t->slots[i].name, separator, t->slots[i].count);
+  fclose(fp);
+}
+
+/* Calls to a quote are counted as `name [ ]`, for the word it's in. */
+void profiler_save() {
+  struct ProfilerTable calls;
+  CELL at, header;
+  char *to;
+  memset(&calls, 0, sizeof(calls));
+  pthread_mutex_lock(&ProfilerLock);
+  if (profiler_calls != NULL) {
+    profiler_update_words();
+    for (at = 0; at < memory[3] && at <= image_size; at++) {
+      if (profiler_calls[at] == 0)
+        continue;
+      header = profiler_word(at);
+      to = profiler_name(profiler_line, header);
+      if (header != 0 && memory[header + D_OFFSET_XT] != at)
+        to += sprintf(to, " [ ]");
+      *to = 0;
+      profiler_count(&calls, profiler_line, profiler_calls[at]);
+    }
+    profiler_write(&calls, getenv("RX_PROFILE_CALLS"), '\t');
+    profiler_clear(&calls);
+  }
+  profiler_write(&ProfilerStacks, getenv("RX_PROFILE"), ' ');
+  pthread_mutex_unlock(&ProfilerLock);
+}
+
+void profiler_start_timer() {
+  struct itimerval timer;
+  timer.it_interval.tv_sec = ProfilerInterval / 1000000;
+  timer.it_interval.tv_usec = ProfilerInterval % 1000000;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void profiler_prepare() {
+  char *stacks = getenv("RX_PROFILE");
+  char *rate = getenv("RX_PROFILE_HZ");
+  struct sigaction action;
+  long hz = (rate != NULL) ? strtol(rate, NULL, 10) : 1000;
+  if (stacks == NULL && getenv("RX_PROFILE_CALLS") == NULL)
+    return;
+  ProfilerOn = 1;
+  if (getenv("RX_PROFILE_CALLS") != NULL) {
+    ProfilerCalls = mmap(NULL, (image_size + 1) * sizeof(uint64_t),
+                         PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ProfilerCalls == MAP_FAILED)
+      ProfilerCalls = NULL;
+    profiler_calls = ProfilerCalls;
+  }
+  if (stacks != NULL) {
+    ProfilerInterval = 1000000 / ((hz < 1) ? 1 : (hz > 100000) ? 100000 : hz);
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = profiler_tick;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    profiler_start_timer();
+  }
+  atexit(profiler_save);
+}
+
+/* A forked child starts with nothing counted. Timers aren't kept over
+   a fork, so it's restarted. */
+void profiler_forget() {
+  if (!ProfilerOn)
+    return;
+  pthread_mutex_init(&ProfilerLock, NULL);
+  profiler_clear(&ProfilerStacks);
+  if (ProfilerCalls != NULL)
+    madvise(ProfilerCalls, (image_size + 1) * sizeof(uint64_t), MADV_DONTNEED);
+  if (ProfilerInterval != 0)
+    profiler_start_timer();
+}
+
+#ifdef NGA_JIT
+/*---------------------------------------------------------------------
+  A basic block compiler for x86-64. A run of bundles ending with the
+  first one that jumps, calls, returns, or halts is translated to native
+  code after it has been started JIT_THRESHOLD times, and is cached by
+  its starting address. Bundles using `iq` or `ii`, and those that have
+  anything other than nops after a control flow instruction, are left
+  to the interpreter, as are invalid bundles.
+
+  The stack depths inside a block change by amounts known when it is
+  translated, so the stacks are addressed at fixed offsets from their
+  entry values and the top of the data stack is kept in a register.
+  Each block begins by checking:
+
+  - that the stacks are deep enough for everything in the block. If
+    not, the bundle is interpreted so underflow behaves as it always
+    has.
+  - that the cells it was translated from are unchanged. If not (any
+    store, from the VM or from an I/O handler, can change them), the
+    translation is dropped and the bundle is interpreted.
+
+  A store into the running block leaves it right after the store; the
+  remainder of that bundle is then run by the interpreter.
+
+  A block that ends with a translation available for the next ip jumps
+  straight to it. Otherwise it returns to `execute()`, which runs
+  untranslated bundles and decides when to translate. In the threaded
+  engine this is done when each bundle is fetched, so code not (yet)
+  translated still runs as threaded code and superinstructions; the
+  switch based loop uses `jit_execute()`.
+
+  Set RX_JIT=0 in the environment to use the interpreter alone.
+  ---------------------------------------------------------------------*/
+
+#define JIT_THRESHOLD    16
+#define JIT_MAX_BUNDLES  32
+#define JIT_CODE_SIZE    (32 * 1024 * 1024)
+#define JIT_HEADROOM     (64 * 1024)
+
+#define JIT_OK       0            /* Block ran to the end              */
+#define JIT_STALE    1            /* Source cells have changed         */
+#define JIT_SHALLOW  2            /* Stacks too shallow for the block  */
+#define JIT_RESUME   3            /* Left after a store into the block */
+
+typedef struct {
+  CELL *memory, *data, *address;
+  CELL sp, rp, ip, status, pending;
+} JitState;
+
+typedef CELL (*JitBlock)(JitState *);
+
+#define J_ST   offsetof(JitState, sp)
+#define J_RT   offsetof(JitState, rp)
+
+#define RAX  0                    /* Scratch                           */
+#define RCX  1                    /* Scratch                           */
+#define RDX  2                    /* Scratch                           */
+#define RSI  6                    /* memory                            */
+#define RDI  7                    /* JitState *                        */
+#define R8   8                    /* &data[sp] on entry                */
+#define R9   9                    /* &address[rp] on entry             */
+#define R11  11                   /* Top of the data stack             */
+
+#define JMP  0xE9
+#define JAE  0x0F83
+#define JE   0x0F84
+#define JNE  0x0F85
+#define JS   0x0F88
+#define JL   0x0F8C
+#define JA   0x0F87
+
+VM_LOCAL int jit_enabled;
+VM_LOCAL unsigned char *jit_code, *jit_here;
+VM_LOCAL JitBlock *jit_blocks;    /* Translations, by starting address */
+VM_LOCAL unsigned char *jit_heat; /* Times started while untranslated  */
+VM_LOCAL int jit_need, jit_rneed; /* Minimum entry depths for a block  */
+
+void jit_byte(int b) {
+  *jit_here++ = (unsigned char)b;
+}
+
+void jit_cell(CELL v) {
+  memcpy(jit_here, &v, 4);
+  jit_here += 4;
+}
+
+void jit_op(int w, int op, int reg, int rm) {
+  int rex = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+  if (rex != 0x40) jit_byte(rex);
+  if (op > 0xFF) jit_byte(op >> 8);
+  jit_byte(op & 0xFF);
+}
+
+/* `op reg, r/m` with a register operand */
+void jit_reg(int w, int op, int reg, int rm) {
+  jit_op(w, op, reg, rm);
+  jit_byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+/* `op reg, [base + disp]`; the base is never rsp, rbp, r12, or r13 */
+void jit_mem(int w, int op, int reg, int base, int disp) {
+  jit_op(w, op, reg, base);
+  if (disp >= -128 && disp < 128) {
+    jit_byte(0x40 | ((reg & 7) << 3) | (base & 7));
+    jit_byte(disp);
+  } else {
+    jit_byte(0x80 | ((reg & 7) << 3) | (base & 7));
+    jit_cell(disp);
+  }
+}
+
+/* `op reg, [memory + rax * 4]` */
+void jit_indexed(int op, int reg) {
+  jit_op(0, op, reg, 0);
+  jit_byte(0x04 | ((reg & 7) << 3));
+  jit_byte(0x86);
+}
+
+/* `op r/m, imm32`, where op is the /digit of the 0x81 group */
+void jit_imm(int digit, int rm, CELL v) {
+  jit_reg(0, 0x81, digit, rm);
+  jit_cell(v);
+}
+
+void jit_movi(int reg, CELL v) {
+  if (reg & 8) jit_byte(0x41);
+  jit_byte(0xB8 + (reg & 7));
+  jit_cell(v);
+}
+
+unsigned char *jit_jump(int op) {
+  if (op > 0xFF) jit_byte(op >> 8);
+  jit_byte(op & 0xFF);
+  jit_cell(0);
+  return jit_here - 4;
+}
+
+void jit_land(unsigned char *at) {
+  CELL rel = jit_here - (at + 4);
+  memcpy(at, &rel, 4);
+}
+
+void jit_jump_to(int op, unsigned char *to) {
+  CELL rel;
+  jit_jump(op);
+  rel = to - jit_here;
+  memcpy(jit_here - 4, &rel, 4);
+}
+
+/* Displacements of data stack slot `n` and address stack slot `n`,
+   relative to the entry depths. */
+int jit_slot(int n) {
+  if (jit_need < -n) jit_need = -n;
+  return n * 4;
+}
+
+int jit_rslot(int n) {
+  if (jit_rneed < -n) jit_rneed = -n;
+  return n * 4;
+}
+
+void jit_load_tos(int n) {
+  jit_mem(0, 0x8B, R11, R8, jit_slot(n));
+}
+
+void jit_save_tos(int n) {
+  jit_mem(0, 0x89, R11, R8, jit_slot(n));
+}
+
+void jit_sync(int d, int rd) {
+  jit_save_tos(d);
+  if (d != 0)  { jit_mem(0, 0x81, 0, RDI, J_ST); jit_cell(d); }
+  if (rd != 0) { jit_mem(0, 0x81, 0, RDI, J_RT); jit_cell(rd); }
+}
+
+/* Write back the stack pointers and go on to the translation of the
+   next ip (in eax, or the `next` value) if there is one and no
+   profiler sample is due. Otherwise it is returned to `execute()`. */
+void jit_leave(int d, int rd, int in_eax, CELL next) {
+  unsigned char *stop[4] = { NULL, NULL, NULL, NULL };
+  JitBlock *blocks = jit_blocks;
+  volatile sig_atomic_t *due = &profiler_due;
+  jit_sync(d, rd);
+  if (!in_eax) jit_movi(RAX, next);
+  jit_mem(0, 0x8B, RDX, RDI, J_RT);
+  jit_reg(0, 0x85, RDX, RDX);
+  stop[0] = jit_jump(JE);
+  jit_imm(7, RAX, image_size);
+  stop[1] = jit_jump(JAE);
+  if (ProfilerInterval != 0) {
+    jit_byte(0x48); jit_byte(0xBA);
+    memcpy(jit_here, &due, 8);
+    jit_here += 8;
+    jit_mem(0, 0x83, 7, RDX, 0);
+    jit_byte(0);
+    stop[3] = jit_jump(JNE);
+  }
+  jit_byte(0x48); jit_byte(0xBA);
+  memcpy(jit_here, &blocks, 8);
+  jit_here += 8;
+  jit_byte(0x48); jit_byte(0x8B); jit_byte(0x14); jit_byte(0xC2);
+  jit_reg(1, 0x85, RDX, RDX);
+  stop[2] = jit_jump(JE);
+  jit_reg(0, 0xFF, 4, RDX);
+  jit_land(stop[0]);
+  jit_land(stop[1]);
+  jit_land(stop[2]);
+  if (ProfilerInterval != 0) jit_land(stop[3]);
+  jit_byte(0xC3);
+}
+
+/* Return to `execute()` with a status and the ip to continue at */
+void jit_status(int status, CELL at) {
+  jit_mem(0, 0xC7, 0, RDI, offsetof(JitState, ip));
+  jit_cell(at);
+  jit_mem(0, 0xC7, 0, RDI, offsetof(JitState, status));
+  jit_cell(status);
+  jit_byte(0xC3);
+}
+
+void jit_flush() {
+  jit_here = jit_code;
+  madvise(jit_blocks, (image_size + 1) * sizeof(JitBlock), MADV_DONTNEED);
+}
+
+int jit_is_control(int op) {
+  return (op >= 7 && op <= 10) || op == 25 || op == 26;
+}
+
+JitBlock jit_translate(CELL at) {
+  CELL starts[JIT_MAX_BUNDLES];
+  CELL p, i, b, op, pending;
+  unsigned char *stale, *shallow, *skip, *patch_need, *patch_rneed;
+  unsigned char *done[5], *next;
+  JitBlock entry;
+  int *devices_at = &devices;
+  int n, j, k, x, lits, control, ended, d, rd;
+
+  /* Find the bundles making up the block */
+  for (n = 0, p = at; n < JIT_MAX_BUNDLES && p < image_size; ) {
+    b = memory[p];
+    if (!BUNDLE_VALID(b)) break;
+    for (k = lits = control = 0, x = 1; k < 4; k++) {
+      op = (b >> (8 * k)) & 0xFF;
+      if (op == 28 || op == 29 || (control && op != 0)) x = 0;
+      if (op == 1) lits++;
+      if (jit_is_control(op)) control = 1;
+    }
+    if (!x || p + lits >= image_size) break;
+    starts[n++] = p;
+    p += 1 + lits;
+    if (control) break;
+  }
+  if (n == 0) return NULL;
+
+  if (jit_here + JIT_HEADROOM > jit_code + JIT_CODE_SIZE) jit_flush();
+
+  stale = jit_here;
+  jit_status(JIT_STALE, at);
+  shallow = jit_here;
+  jit_status(JIT_SHALLOW, at);
+
+  entry = (JitBlock)jit_here;
+  jit_mem(1, 0x8B, RSI, RDI, offsetof(JitState, memory));
+  for (i = at; i < p; i++) {
+    jit_mem(0, 0x81, 7, RSI, i * 4);
+    jit_cell(memory[i]);
+    jit_jump_to(JNE, stale);
+  }
+  jit_mem(1, 0x63, RAX, RDI, J_ST);
+  jit_imm(7, RAX, 0);
+  patch_need = jit_here - 4;
+  jit_jump_to(JL, shallow);
+  jit_mem(1, 0x8B, R8, RDI, offsetof(JitState, data));
+  jit_byte(0x4D); jit_byte(0x8D); jit_byte(0x04); jit_byte(0x80);
+  jit_mem(1, 0x63, RAX, RDI, J_RT);
+  jit_imm(7, RAX, 0);
+  patch_rneed = jit_here - 4;
+  jit_jump_to(JL, shallow);
+  jit_mem(1, 0x8B, R9, RDI, offsetof(JitState, address));
+  jit_byte(0x4D); jit_byte(0x8D); jit_byte(0x0C); jit_byte(0x81);
+
+  jit_need = jit_rneed = 0;
+  d = rd = ended = 0;
+  jit_load_tos(0);
+
+  for (x = 0; x < n; x++) {
+    i = starts[x];
+    b = memory[i];
+    if (x > 0 && jit_rneed < 1 - rd) jit_rneed = 1 - rd;
+    for (k = 0; k < 4; k++) {
+      op = (b >> (8 * k)) & 0xFF;
+      if (jit_is_control(op)) ended = 1;
+      switch (op) {
+        case 0:                                            /* no */
+          break;
+        case 1:                                            /* li */
+          jit_save_tos(d++);
+          jit_movi(R11, memory[++i]);
+          break;
+        case 2:                                            /* du */
+          jit_save_tos(d++);
+          break;
+        case 3:                                            /* dr */
+          jit_load_tos(--d);
+          break;
+        case 4:                                            /* sw */
+          jit_mem(0, 0x8B, RAX, R8, jit_slot(d - 1));
+          jit_mem(0, 0x89, R11, R8, jit_slot(d - 1));
+          jit_reg(0, 0x89, RAX, R11);
+          break;
+        case 5:                                            /* pu */
+          jit_mem(0, 0x89, R11, R9, jit_rslot(++rd));
+          jit_load_tos(--d);
+          break;
+        case 6:                                            /* po */
+          jit_save_tos(d++);
+          jit_mem(0, 0x8B, R11, R9, jit_rslot(rd--));
+          break;
+        case 7:                                            /* ju */
+          jit_reg(0, 0x89, R11, RAX);
+          jit_load_tos(--d);
+          jit_leave(d, rd, 1, 0);
+          break;
+        case 8:                                            /* ca */
+          jit_mem(0, 0xC7, 0, R9, jit_rslot(++rd));
+          jit_cell(i);
+          jit_reg(0, 0x89, R11, RAX);
+          jit_load_tos(--d);
+          jit_leave(d, rd, 1, 0);
+          break;
+        case 9:                                            /* cc */
+          jit_reg(0, 0x89, R11, RCX);
+          jit_load_tos(--d);
+          jit_reg(0, 0x89, R11, RDX);
+          jit_load_tos(--d);
+          jit_reg(0, 0x85, RDX, RDX);
+          skip = jit_jump(JE);
+          jit_mem(0, 0xC7, 0, R9, jit_rslot(rd + 1));
+          jit_cell(i);
+          jit_reg(0, 0x89, RCX, RAX);
+          jit_leave(d, rd + 1, 1, 0);
+          jit_land(skip);
+          jit_leave(d, rd, 0, i + 1);
+          break;
+        case 10:                                           /* re */
+          jit_mem(0, 0x8B, RAX, R9, jit_rslot(rd--));
+          jit_imm(0, RAX, 1);
+          jit_leave(d, rd, 1, 0);
+          break;
+        case 11: case 12: case 13: case 14:                /* eq ne lt gt */
+          jit_mem(0, 0x8B, RAX, R8, jit_slot(d - 1));
+          jit_reg(0, 0x39, R11, RAX);
+          jit_byte(0x0F);
+          jit_byte(op == 11 ? 0x94 : op == 12 ? 0x95 : op == 13 ? 0x9C : 0x9F);
+          jit_byte(0xC0);
+          jit_reg(0, 0x0FB6, R11, RAX);
+          jit_reg(0, 0xF7, 3, R11);
+          d--;
+          break;
+        case 15:                                           /* fe */
+          jit_mem(0, 0x8D, RAX, R11, 5);
+          jit_imm(7, RAX, 4);
+          skip = jit_jump(JA);
+          for (j = 0; j < 5; j++) {
+            if (j < 4) {
+              jit_imm(7, RAX, 4 - j);
+              next = jit_jump(JNE);
+            }
+            if (j == 0) {
+              jit_mem(0, 0x8B, R11, RDI, J_ST);
+              jit_imm(0, R11, d - 1);
+            } else if (j == 1) {
+              jit_mem(0, 0x8B, R11, RDI, J_RT);
+              jit_imm(0, R11, rd);
+            } else {
+              jit_movi(R11, j == 2 ? image_size :
+                            j == 3 ? CELL_MIN : CELL_MAX);
+            }
+            done[j] = jit_jump(JMP);
+            if (j < 4) jit_land(next);
+          }
+          jit_land(skip);
+          jit_reg(1, 0x63, RAX, R11);
+          jit_indexed(0x8B, R11);
+          for (j = 0; j < 5; j++)
+            jit_land(done[j]);
+          break;
+        case 16:                                           /* st */
+          jit_mem(0, 0x8B, RCX, R8, jit_slot(d - 1));
+          jit_reg(1, 0x63, RAX, R11);
+          jit_indexed(0x89, RCX);
+          jit_imm(5, RAX, at);
+          jit_imm(7, RAX, p - at);
+          d -= 2;
+          jit_load_tos(d);
+          skip = jit_jump(JAE);
+          pending = (b >> (8 * k)) >> 8;
+          jit_sync(d, rd);
+          jit_mem(0, 0xC7, 0, RDI, offsetof(JitState, pending));
+          jit_cell(pending);
+          jit_status(JIT_RESUME, i);
+          jit_land(skip);
+          break;
+        case 17: case 18: case 21: case 22: case 23:       /* ad su an or xo */
+          jit_mem(0, 0x8B, RAX, R8, jit_slot(d - 1));
+          jit_reg(0, op == 17 ? 0x01 : op == 18 ? 0x29 : op == 21 ? 0x21 :
+                     op == 22 ? 0x09 : 0x31, R11, RAX);
+          jit_reg(0, 0x89, RAX, R11);
+          d--;
+          break;
+        case 19:                                           /* mu */
+          jit_mem(0, 0x8B, RAX, R8, jit_slot(d - 1));
+          jit_reg(0, 0x0FAF, RAX, R11);
+          jit_reg(0, 0x89, RAX, R11);
+          d--;
+          break;
+        case 20:                                           /* di */
+          jit_mem(0, 0x8B, RAX, R8, jit_slot(d - 1));
+          jit_byte(0x99);
+          jit_reg(0, 0xF7, 7, R11);
+          jit_mem(0, 0x89, RDX, R8, jit_slot(d - 1));
+          jit_reg(0, 0x89, RAX, R11);
+          break;
+        case 24:                                           /* sh */
+          jit_reg(0, 0x89, R11, RCX);
+          jit_mem(0, 0x8B, RAX, R8, jit_slot(d - 1));
+          jit_reg(0, 0x85, RCX, RCX);
+          skip = jit_jump(JS);
+          jit_reg(0, 0xD3, 7, RAX);
+          next = jit_jump(JMP);
+          jit_land(skip);
+          jit_reg(0, 0xF7, 3, RCX);
+          jit_reg(0, 0xD3, 4, RAX);
+          jit_land(next);
+          jit_reg(0, 0x89, RAX, R11);
+          d--;
+          break;
+        case 25:                                           /* zr */
+          jit_reg(0, 0x85, R11, R11);
+          skip = jit_jump(JNE);
+          jit_load_tos(d - 1);
+          jit_mem(0, 0x8B, RAX, R9, jit_rslot(rd));
+          jit_imm(0, RAX, 1);
+          jit_leave(d - 1, rd - 1, 1, 0);
+          jit_land(skip);
+          jit_leave(d, rd, 0, i + 1);
+          break;
+        case 26:                                           /* ha */
+          jit_leave(d, rd, 0, image_size + 1);
+          break;
+        case 27:                                           /* ie */
+          jit_save_tos(d++);
+          jit_byte(0x48); jit_byte(0xB8);
+          memcpy(jit_here, &devices_at, 8);
+          jit_here += 8;
+          jit_mem(0, 0x8B, R11, RAX, 0);
+          break;
+      }
+    }
+  }
+  if (!ended)
+    jit_leave(d, rd, 0, p);
+
+  memcpy(patch_need, &jit_need, 4);
+  memcpy(patch_rneed, &jit_rneed, 4);
+  return entry;
+}
+
+void jit_prepare() {
+  char *setting = getenv("RX_JIT");
+  if (setting != NULL && strcmp(setting, "0") == 0) return;
+  if (ProfilerCalls != NULL) return;
+  jit_code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  jit_blocks = mmap(NULL, (image_size + 1) * sizeof(JitBlock),
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  jit_heat = mmap(NULL, image_size + 1, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (jit_code == MAP_FAILED || jit_blocks == MAP_FAILED ||
+      jit_heat == MAP_FAILED)
+    return;
+  jit_here = jit_code;
+  jit_enabled = 1;
+}
+
+#ifndef NGA_THREADED
+void jit_execute(CELL cell) {
+  JitState state;
+  JitBlock block;
+  CELL opcode, next;
+  state.memory = memory;
+  state.data = data;
+  state.address = address;
+  if (rp == 0) {
+    rp = 1;
+    profiler_root = cell;
+  }
+  ip = cell;
+  while (ip < image_size) {
+    if (profiler_due)
+      profiler_sample();
+    block = jit_blocks[ip];
+    if (block == NULL && ++jit_heat[ip] >= JIT_THRESHOLD) {
+      jit_heat[ip] = 0;
+      block = jit_blocks[ip] = jit_translate(ip);
+    }
+    if (block != NULL) {
+      state.sp = sp;
+      state.rp = rp;
+      state.status = JIT_OK;
+      next = block(&state);
+      sp = state.sp;
+      rp = state.rp;
+      if (state.status == JIT_OK || state.status == JIT_RESUME) {
+        ip = next;
+        if (state.status == JIT_RESUME) {
+          ip = state.ip;
+          process_opcode_bundle(state.pending);
+          ip++;
+        }
+        if (rp == 0) {
+          ip = image_size;
+        }
+        continue;
+      }
+      ip = state.ip;
+      if (state.status == JIT_STALE)
+        jit_blocks[ip] = NULL;
+    }
+    opcode = memory[ip];
+    if (!BUNDLE_VALID(opcode))
+      invalid_bundle(ip, opcode);
+    process_opcode_bundle(opcode);
+    ip++;
+    if (rp == 0) {
+      ip = image_size;
+    }
+  }
+}
+#endif
+#endif
+
+#ifndef NGA_THREADED
+void execute(CELL cell) {
+  CELL opcode;
+#ifdef NGA_JIT
+  if (jit_enabled) {
+    jit_execute(cell);
+    return;
+  }
+#endif
+  if (rp == 0) {
+    rp = 1;
+    profiler_root = cell;
+  }
+  ip = cell;
+  while (ip < image_size) {
+    if (profiler_due)
+      profiler_sample();
+    opcode = memory[ip];
+    if (validate_opcode_bundle(opcode) != 0) {
+      process_opcode_bundle(opcode);
+    } else {
+      invalid_bundle(ip, opcode);
+    }
+    ip++;
+    if (rp == 0) {
+      ip = image_size;
+    }
+  }
+}
+#else
+/*---------------------------------------------------------------------
+  Direct threaded dispatch. Each opcode is a label and the next one is
+  reached through a computed goto, with the instruction pointer, stack
+  pointers, and top of stack held in locals. The globals are written
+  back before any I/O handler runs (as these use `stack_push()`, etc)
+  and reloaded afterwards.
+
+  A bundle is valid when all four bytes are in the 0 - 29 range. This
+  is checked with a single mask test when the bundle is fetched, so an
+  invalid bundle is still rejected before any of its opcodes run. As in
+  the switch based loop, opcodes following a jump, call, or return in
+  the same bundle are still executed.
+
+  Frequently used bundles are also run as superinstructions: a single
+  label with the bodies of all four opcodes, found by hashing the whole
+  cell. The list of these is generated from a bundle profile, and is
+  rebuilt by `make` whenever the kernel or the standard library change;
+  see the `src,superinstructions.h` rule in the Makefile.
+
+  Built with NGA_NATIVE, the code in an image is compiled ahead of time
+  as well (see `image-to-native` and the `native` target). Each bundle
+  reachable from the words in the image is a label in `src,native.h`,
+  found by address, and running into the next bundle or calling or
+  jumping to a known address is a plain or direct goto. Each bundle
+  first checks that its cells are unchanged, and the interpreter runs
+  any that have been overwritten, along with anything not compiled.
+  The Makefile builds this without GCC's global CSE passes, which (as
+  its manual notes) do poorly with computed gotos: it halves the build
+  time and the compiled code runs faster too.
+  ---------------------------------------------------------------------*/
+
+#define T_NEXT      if ((bundle >>= 8) != 0) goto *ops[bundle & 0xFF]; \
+                    goto end_of_bundle
+#define T_DROP      if (--s < 0) i = image_size; tos = data[s < 0 ? 0 : s]
+#define T_POP(v)    tos = (v); if (--s < 0) i = image_size
+#define T_PUSH(v)   data[s++] = tos; tos = (v)
+#define T_SYNC      if (s >= 0) data[s] = tos; sp = s; rp = r; ip = i
+#define T_RELOAD    s = sp; r = rp; i = ip; tos = data[s]
+
+#define O_NO
+#define O_LI  i++; T_PUSH(mem[i]);
+#define O_DU  T_PUSH(tos);
+#define O_DR  T_DROP;
+#define O_SW  a = tos; tos = data[s - 1]; data[s - 1] = a;
+#define O_PU  address[++r] = tos; T_DROP;
+#define O_PO  T_PUSH(address[r]); r--;
+#define O_JU  i = tos - 1; T_DROP;
+#define O_CA  PROFILER_ENTER(calls, tos); address[++r] = i; i = tos - 1; T_DROP;
+#define O_CC  a = tos; T_DROP; \
+              b = tos; T_DROP; \
+              if (b != 0) { PROFILER_ENTER(calls, a); address[++r] = i; i = a - 1; }
+#define O_RE  i = address[r--];
+#define O_EQ  T_POP((data[s - 1] == tos) ? -1 : 0);
+#define O_NE  T_POP((data[s - 1] != tos) ? -1 : 0);
+#define O_LT  T_POP((data[s - 1] < tos) ? -1 : 0);
+#define O_GT  T_POP((data[s - 1] > tos) ? -1 : 0);
+#define O_FE  switch (tos) { \
+                case -1: tos = s - 1; break; \
+                case -2: tos = r; break; \
+                case -3: tos = image_size; break; \
+                case -4: tos = CELL_MIN; break; \
+                case -5: tos = CELL_MAX; break; \
+                default: tos = mem[tos]; break; \
+              }
+#define O_ST  mem[tos] = data[s - 1]; T_DROP; T_DROP;
+#define O_AD  T_POP(data[s - 1] + tos);
+#define O_SU  T_POP(data[s - 1] - tos);
+#define O_MU  T_POP(data[s - 1] * tos);
+#define O_DI  a = tos; b = data[s - 1]; tos = b / a; data[s - 1] = b % a;
+#define O_AN  T_POP(tos & data[s - 1]);
+#define O_OR  T_POP(tos | data[s - 1]);
+#define O_XO  T_POP(tos ^ data[s - 1]);
+#define O_SH  a = tos; b = data[s - 1]; \
+              if (a < 0) b = b << (0 - a); \
+              else if (b < 0 && a > 0) b = b >> a | ~(~0U >> a); \
+              else b = b >> a; \
+              T_POP(b);
+#define O_ZR  if (tos == 0) { T_DROP; i = address[r--]; }
+#define O_HA  i = image_size;
+#define O_IE  T_PUSH(devices);
+#define O_IQ  a = tos; T_DROP; T_SYNC; \
+              if (IoStatsOn) io_measured(a, 1); else IO_queryHandlers[a](); \
+              T_RELOAD;
+#define O_II  a = tos; T_DROP; T_SYNC; \
+              if (IoStatsOn) io_measured(a, 0); else IO_deviceHandlers[a](); \
+              T_RELOAD;
+
+#define SUPER_SLOTS  256
+
+#ifdef NGA_BUNDLE_PROFILE
+#define PROFILE_SLOTS  65536
+
+struct bundle_count {
+  CELL bundle;
+  long count;
+} BundleCounts[PROFILE_SLOTS];
+
+void profile_count(CELL bundle, long n) {
+  uint32_t h = ((uint32_t)bundle * 2654435761u) >> 16;
+  while (BundleCounts[h].count != 0 && BundleCounts[h].bundle != bundle)
+    h = (h + 1) & (PROFILE_SLOTS - 1);
+  BundleCounts[h].bundle = bundle;
+  BundleCounts[h].count += n;
+}
+
+int profile_compare(const void *a, const void *b) {
+  long x = ((struct bundle_count *)a)->count;
+  long y = ((struct bundle_count *)b)->count;
+  return (x < y) - (x > y);
+}
+
+/* Counts are merged into the file named by RX_BUNDLE_PROFILE, so a
+   profile can be accumulated over several runs. */
+void profile_save() {
+  char *name = getenv("RX_BUNDLE_PROFILE");
+  long count;
+  CELL bundle;
+  int i;
+  FILE *fp;
+  if (name == NULL) return;
+  if ((fp = fopen(name, "r")) != NULL) {
+    while (fscanf(fp, "%d %ld", &bundle, &count) == 2)
+      profile_count(bundle, count);
+    fclose(fp);
+  }
+  if ((fp = fopen(name, "w")) == NULL) return;
+  qsort(BundleCounts, PROFILE_SLOTS, sizeof(struct bundle_count),
+        profile_compare);
+  for (i = 0; i < PROFILE_SLOTS && BundleCounts[i].count != 0; i++)
+    fprintf(fp, "%d\t%ld\n", BundleCounts[i].bundle, BundleCounts[i].count);
+  fclose(fp);
+}
+#endif
+
+void execute(CELL cell) {
+  static void *ops[] = {
+    &&op_no, &&op_li, &&op_du, &&op_dr, &&op_sw, &&op_pu, &&op_po,
+    &&op_ju, &&op_ca, &&op_cc, &&op_re, &&op_eq, &&op_ne, &&op_lt,
+    &&op_gt, &&op_fe, &&op_st, &&op_ad, &&op_su, &&op_mu, &&op_di,
+    &&op_an, &&op_or, &&op_xo, &&op_sh, &&op_zr, &&op_ha, &&op_ie,
+    &&op_iq, &&op_ii
+  };
+  static CELL super_bundles[SUPER_SLOTS];
+  static void *super_labels[SUPER_SLOTS];
+  static int super_ready = 0;
+#ifdef NGA_NATIVE
+  static void **native_labels;
+  static CELL native_cells;
+#endif
+#ifdef NGA_JIT
+  JitState state;
+  JitBlock block;
+#endif
+  CELL i, s, r, tos, bundle, a, b;
+  CELL *mem = memory;
+  uint64_t *calls = profiler_calls;
+  uint32_t h;
+
+#ifdef NGA_JIT
+  state.memory = memory;
+  state.data = data;
+  state.address = address;
+#endif
+  if (!super_ready) {
+#define SUPER(v, o1, o2, o3, o4) \
+    for (h = ((uint32_t)v * 2654435761u) >> 24; super_bundles[h]; ) \
+      h = (h + 1) & (SUPER_SLOTS - 1); \
+    super_bundles[h] = v; \
+    super_labels[h] = &&super_##v;
+#include "src,superinstructions.h"
+#undef SUPER
+#ifdef NGA_NATIVE
+#define N_CELLS(n)    native_labels = calloc(n, sizeof(void *)); \
+                      native_cells = native_labels ? n : 0;
+#define N_AT(at, v)   if (native_cells) native_labels[at] = &&native_##at;
+#define N_LIT(at, v)
+#define N_LI(v)
+#define N_OP(o)
+#define N_CALL(x)
+#define N_JUMP(x)
+#define N_NEXT(at)
+#define N_END
+#include "src,native.h"
+#undef N_CELLS
+#undef N_AT
+#undef N_LIT
+#undef N_LI
+#undef N_OP
+#undef N_CALL
+#undef N_JUMP
+#undef N_NEXT
+#undef N_END
+#endif
+    super_ready = 1;
+  }
+
+  if (rp == 0) {
+    rp = 1;
+    profiler_root = cell;
+  }
+  ip = cell;
+  T_RELOAD;
+
+fetch:
+  if (i >= image_size) goto leave;
+  if (profiler_due) {
+    T_SYNC;
+    profiler_sample();
+  }
+#ifdef NGA_NATIVE
+  if (i < native_cells && native_labels[i] != NULL)
+    goto *native_labels[i];
+#endif
+#ifdef NGA_JIT
+  if (jit_enabled) {
+    block = jit_blocks[i];
+    if (block == NULL && ++jit_heat[i] >= JIT_THRESHOLD) {
+      jit_heat[i] = 0;
+      block = jit_blocks[i] = jit_translate(i);
+    }
+    if (block != NULL) {
+      T_SYNC;
+      state.sp = sp;
+      state.rp = rp;
+      state.status = JIT_OK;
+      a = block(&state);
+      sp = state.sp;
+      rp = state.rp;
+      ip = (state.status == JIT_OK) ? a : state.ip;
+      T_RELOAD;
+      if (state.status == JIT_OK) {
+        if (r == 0) i = image_size;
+        goto fetch;
+      }
+      if (state.status == JIT_RESUME) {
+        bundle = state.pending;
+        goto *ops[bundle & 0xFF];
+      }
+      if (state.status == JIT_STALE)
+        jit_blocks[i] = NULL;
+    }
+  }
+#endif
+#ifdef NGA_NATIVE
+run_bundle:
+#endif
+  bundle = mem[i];
+#ifdef NGA_BUNDLE_PROFILE
+  profile_count(bundle, 1);
+#endif
+  for (h = ((uint32_t)bundle * 2654435761u) >> 24; super_bundles[h]; ) {
+    if (super_bundles[h] == bundle) goto *super_labels[h];
+    h = (h + 1) & (SUPER_SLOTS - 1);
+  }
+  if (!BUNDLE_VALID(bundle)) {
+    T_SYNC;
+    invalid_bundle(i, bundle);
+  }
+  goto *ops[bundle & 0xFF];
+
+end_of_bundle:
+  i++;
+  if (r == 0) i = image_size;
+  goto fetch;
+
+#define SUPER(v, o1, o2, o3, o4) \
+super_##v: O_##o1 O_##o2 O_##o3 O_##o4 goto end_of_bundle;
+#include "src,superinstructions.h"
+#undef SUPER
+
+#ifdef NGA_NATIVE
+#define N_CELLS(n)
+#define N_AT(at, v)   native_##at: i = at; if (mem[at] != (v)) goto run_bundle;
+#define N_LIT(at, v)  if (mem[at] != (v)) goto run_bundle;
+#define N_LI(v)       i++; T_PUSH(v);
+#define N_OP(o)       O_##o
+#define N_CALL(x)     i++; PROFILER_ENTER(calls, x); address[++r] = i; \
+                      i = x; goto native_##x;
+#define N_JUMP(x)     i = x; goto native_##x;
+#define N_NEXT(at)    if (i != at || r == 0) goto end_of_bundle;
+#define N_END         goto end_of_bundle;
+#include "src,native.h"
+#undef N_CELLS
+#undef N_AT
+#undef N_LIT
+#undef N_LI
+#undef N_OP
+#undef N_CALL
+#undef N_JUMP
+#undef N_NEXT
+#undef N_END
+#endif
+
+op_no: T_NEXT;
+op_li: O_LI T_NEXT;
+op_du: O_DU T_NEXT;
+op_dr: O_DR T_NEXT;
+op_sw: O_SW T_NEXT;
+op_pu: O_PU T_NEXT;
+op_po: O_PO T_NEXT;
+op_ju: O_JU T_NEXT;
+op_ca: O_CA T_NEXT;
+op_cc: O_CC T_NEXT;
+op_re: O_RE T_NEXT;
+op_eq: O_EQ T_NEXT;
+op_ne: O_NE T_NEXT;
+op_lt: O_LT T_NEXT;
+op_gt: O_GT T_NEXT;
+op_fe: O_FE T_NEXT;
+op_st: O_ST T_NEXT;
+op_ad: O_AD T_NEXT;
+op_su: O_SU T_NEXT;
+op_mu: O_MU T_NEXT;
+op_di: O_DI T_NEXT;
+op_an: O_AN T_NEXT;
+op_or: O_OR T_NEXT;
+op_xo: O_XO T_NEXT;
+op_sh: O_SH T_NEXT;
+op_zr: O_ZR T_NEXT;
+op_ha: O_HA T_NEXT;
+op_ie: O_IE T_NEXT;
+op_iq: O_IQ T_NEXT;
+op_ii: O_II T_NEXT;
+
+leave:
+  T_SYNC;
+}
+#endif
+
+void evaluate(char *s, CELL length) {
+  CELL i;
+  if (length == 0) return;
+  for (i = 0; i < length; i++)
+    memory[TIB + i] = (CELL)s[i];
+  memory[TIB + length] = 0;
+  stack_push(TIB);
+  execute(interpret);
+}
+
+void dump_stack() {
+  CELL i;
+  if (sp == 0)  return;
+  printf("\nStack: ");
+  for (i = 1; i <= sp; i++) {
+    if (i == sp)
+      printf("[ TOS: %d ]", data[i]);
+    else
+      printf("%d ", data[i]);
+  }
+  printf("\n");
+}
+
+int is_separator(char c) {
+  return (c == 10) || (c == 13) || (c == 32) || (c == 0);
+}
+
+int fence_boundary(char *token, long length) {
+  return length >= 3 && token[0] == '~' && token[1] == '~' && token[2] == '~';
+}
+
+/* Source files are mapped (or read, for things like pipes) in one go.
+   Tokens are split out of the buffer in place and copied straight to
+   the TIB, with code between the `~~~` fences being evaluated. */
+
+char *source_load(int fd, long *size, int *mapped) {
+  struct stat st;
+  char *text = NULL, *more;
+  long used = 0, room = 0;
+  ssize_t got;
+  *mapped = 0;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (text != MAP_FAILED) {
+      *mapped = 1;
+      *size = st.st_size;
+      return text;
+    }
+    text = NULL;
+  }
+  for (;;) {
+    if (used == room) {
+      room = room ? room * 2 : 64 * 1024;
+      more = realloc(text, room);
+      if (more == NULL) break;
+      text = more;
+    }
+    got = read(fd, text + used, room - used);
+    if (got <= 0) break;
+    used += got;
+  }
+  *size = used;
+  return text;
 }
 
 void include_file(char *fname) {
   int inBlock = 0;                 /* Tracks status of in/out of block */
-  char source[64 * 1024];          /* Token buffer [about 64K]         */
-  char line[64 * 1024];            /* Line buffer [about 64K]          */
-  char fence[33];                  /* Used with `fence_boundary()`     */
+  char *text;                      /* The file contents                */
+  long size, at, start;
+  int fd, mapped;
 
-  long offset = 0;
-  int tokens = 0;
   CELL ReturnStack[ADDRESSES];
   CELL arp, aip;
 
-  FILE *fp;                        /* Open the file. If not found,     */
-  fp = fopen(fname, "r");          /* exit.                            */
-  if (fp == NULL)
+  fd = open(fname, O_RDONLY);      /* Open the file. If not found,     */
+  if (fd < 0)                      /* exit.                            */
+    return;
+  text = source_load(fd, &size, &mapped);
+  close(fd);
+  if (text == NULL)
     return;
 
   arp = rp;
@@ -470,31 +3378,25 @@ void include_file(char *fname) {
     ReturnStack[rp] = address[rp];
   rp = 0;
 
-  while (!feof(fp)) { /* Loop through the file   */
-
-    offset = ftell(fp);
-    read_line(fp, line);
-    fseek(fp, offset, SEEK_SET);
-
-    tokens = count_tokens(line);
-
-    while (tokens > 0) {
-      tokens--;
-      read_token(fp, source, 0);
-      strlcpy(fence, source, 32); /* Copy the first three characters  */
-      if (fence_boundary(fence) == -1) {
-        if (inBlock == 0)
-          inBlock = 1;
-        else
-          inBlock = 0;
-      } else {
-        if (inBlock == 1) {
-          evaluate(source);
-        }
-      }
-    }
+  at = 0;
+  while (at < size) {
+    while (at < size && is_separator(text[at]))
+      at++;
+    start = at;
+    while (at < size && !is_separator(text[at]))
+      at++;
+    if (at == start)
+      break;
+    if (fence_boundary(text + start, at - start))
+      inBlock = !inBlock;
+    else if (inBlock)
+      evaluate(text + start, at - start);
   }
-  fclose(fp);
+
+  if (mapped)
+    munmap(text, size);
+  else
+    free(text);
 
   for(rp = 0; rp <= arp; rp++)
     address[rp] = ReturnStack[rp];
@@ -507,29 +3409,95 @@ void initialize() {
   load_image();
 }
 
+/* The image size comes from `-m cells` (along with the other flags)
+   or RX_IMAGE_SIZE in the environment, and is IMAGE_SIZE otherwise. */
+CELL requested_image_size(int argc, char **argv) {
+  char *value = getenv("RX_IMAGE_SIZE");
+  long cells;
+  int i;
+  if (argc >= 2 && argv[1][0] == '-')
+    for (i = 1; i < argc - 1; i++)
+      if (strcmp(argv[i], "-m") == 0)
+        value = argv[i + 1];
+  if (value == NULL)
+    return IMAGE_SIZE;
+  cells = strtol(value, NULL, 10);
+  if (cells < MIN_IMAGE_SIZE || cells > MAX_IMAGE_SIZE) {
+    fprintf(stderr, "rx: the image size must be %d to %d cells\n",
+            MIN_IMAGE_SIZE, MAX_IMAGE_SIZE);
+    exit(1);
+  }
+  return cells;
+}
+
 int arg_is(char *argv, char *t) {
   return strcmp(argv, t) == 0;
 }
 
 int main(int argc, char **argv) {
-  int i, fsp;
-  int modes[16];
-  char *files[16];
-
+  image_size = requested_image_size(argc, argv);
+  signal(SIGPIPE, SIG_IGN);
+  output_prepare();
+  input_prepare();
   initialize();
   update_rx();
-  register_device(io_output, query_output);
-  register_device(io_keyboard, query_keyboard);
-  register_device(io_filesystem, query_filesystem);
-  register_device(io_unix, query_unix);
-  register_device(io_scripting, query_scripting);
+#ifdef NGA_BUNDLE_PROFILE
+  atexit(profile_save);
+#endif
+  profiler_prepare();
+  io_stats_prepare();
+#ifdef NGA_JIT
+  jit_prepare();
+#endif
+  register_device(io_output, query_output, "output", 0);
+  register_device(io_keyboard, query_keyboard, "keyboard", 0);
+  register_device(io_filesystem, query_filesystem, "files", ACTIONS(FileActions));
+  register_device(io_unix, query_unix, "unix", ACTIONS(UnixActions));
+  register_device(io_scripting, query_scripting, "scripting", ACTIONS(ScriptingActions));
+  register_device(io_output_actions, query_output_actions, "output-actions", ACTIONS(OutputActions));
+  register_device(io_input_actions, query_input_actions, "input", ACTIONS(InputActions));
+  register_device(io_random, query_rng, "rng", 0);
+  register_device(io_strings, query_strings, "strings", ACTIONS(StringActions));
+  register_device(io_packed, query_packed, "packed", ACTIONS(PackedActions));
+  register_device(io_dirs, query_dirs, "directory", ACTIONS(DirActions));
+  register_device(io_jobs, query_jobs, "jobs", ACTIONS(JobActions));
+  register_device(io_events, query_events, "events", ACTIONS(EventActions));
+  register_device(io_stats, query_stats, "stats", ACTIONS(StatsActions));
 
 
   /* Setup variables related to the scripting device */
   sys_argc = argc;                        /* Point the global argc and */
   sys_argv = argv;                        /* argv to the actual ones   */
 
-  include_file(argv[0]);
+  if (!image_load(argv[0]))               /* Use the saved image if    */
+    include_file(argv[0]);                /* there is one              */
+  else if (ToolEntry != 0)
+    run_tool(argc, argv);
+  else
+    snapshot_take(argv[0]);
+
+  run_arguments(argc, argv);
+}
+
+/* A tool sees its arguments as a script run by `rx` would, so the
+   binary's name takes the place of the script name. */
+void run_tool(int argc, char **argv) {
+  char **args = calloc(argc + 2, sizeof(char *));
+  int i;
+  if (args == NULL) exit(1);
+  args[0] = args[1] = argv[0];
+  for (i = 1; i < argc; i++)
+    args[i + 1] = argv[i];
+  sys_argc = argc + 1;
+  sys_argv = args;
+  execute(ToolEntry);
+  exit(0);
+}
+
+void run_arguments(int argc, char **argv) {
+  int i, fsp;
+  int modes[16];
+  char *files[16];
 
   if (argc >= 2 && argv[1][0] != '-') {
     include_file(argv[1]);                /* If no flags were passed,  */
@@ -552,6 +3520,8 @@ int main(int argc, char **argv) {
       files[fsp] = argv[i + 1];
       fsp++;
       i++;
+    } else if (strcmp(argv[i], "-m") == 0) {
+      i++;
     }
   }
 
@@ -605,20 +3575,23 @@ CELL d_name(CELL dt) {
   return dt + D_OFFSET_NAME;
 }
 
+int d_name_is(CELL dt, char *name) {
+  CELL at = d_name(dt);
+  while (*name && memory[at] == (CELL)*name) {
+    at++;
+    name++;
+  }
+  return *name == 0 && memory[at] == 0;
+}
+
 CELL d_lookup(CELL Dictionary, char *name) {
-  CELL dt = 0;
   CELL i = Dictionary;
-  char *dname;
   while (memory[i] != 0 && i != 0) {
-    dname = string_extract(d_name(i));
-    if (strcmp(dname, name) == 0) {
-      dt = i;
-      i = 0;
-    } else {
-      i = memory[i];
-    }
+    if (d_name_is(i, name))
+      return i;
+    i = memory[i];
   }
-  return dt;
+  return 0;
 }
 
 CELL d_xt_for(char *Name, CELL Dictionary) {
@@ -642,10 +3615,434 @@ CELL load_image() {
   return ngaImageCells;
 }
 
+/*---------------------------------------------------------------------
+  An image snapshot is the used part of memory (up to Heap), followed
+  by four cells: the number of cells saved, the Dictionary and the
+  interpret pointers, and CORE_MAGIC. The Makefile appends one taken
+  after the bootstrap to the binary, so starting up is just a read.
+
+  A tool snapshot has the address of a word in place of `interpret`,
+  and TOOL_MAGIC. A binary with one runs that word with the command
+  line arguments and exits, rather than loading scripts (see
+  `run_tool()` and `save-image`).
+  ---------------------------------------------------------------------*/
+
+#define CORE_MAGIC  0x52584331    /* "RXC1" */
+#define TOOL_MAGIC  0x52585431    /* "RXT1" */
+
+void image_save(char *fname, CELL entry) {
+  CELL trailer[4];
+  FILE *fp;
+  if ((fp = fopen(fname, "wb")) == NULL)
+    return;
+  trailer[0] = memory[3];
+  trailer[1] = memory[2];
+  trailer[2] = entry ? entry : d_xt_for("interpret", memory[2]);
+  trailer[3] = entry ? TOOL_MAGIC : CORE_MAGIC;
+  fwrite(memory, sizeof(CELL), trailer[0], fp);
+  fwrite(trailer, sizeof(CELL), 4, fp);
+  fclose(fp);
+}
+
+int image_load(char *fname) {
+  CELL trailer[4];
+  long cells;
+  int loaded = 0;
+  FILE *fp;
+  if ((fp = fopen(fname, "rb")) == NULL)
+    return 0;
+  if (fseek(fp, -4 * (long)sizeof(CELL), SEEK_END) == 0 &&
+      fread(trailer, sizeof(CELL), 4, fp) == 4 &&
+      (trailer[3] == CORE_MAGIC || trailer[3] == TOOL_MAGIC) &&
+      trailer[0] > 0 && trailer[0] < image_size) {
+    cells = trailer[0];
+    if (fseek(fp, -(cells + 4) * (long)sizeof(CELL), SEEK_END) == 0 &&
+        fread(memory, sizeof(CELL), cells, fp) == (size_t)cells) {
+      Dictionary = trailer[1];
+      interpret = trailer[2];
+      if (trailer[3] == TOOL_MAGIC) {
+        ToolEntry = interpret;
+        interpret = d_xt_for("interpret", Dictionary);
+      }
+      loaded = 1;
+    }
+  }
+  fclose(fp);
+  return loaded;
+}
+
+/*---------------------------------------------------------------------
+  A command that runs this same binary (as `run-command` does) is run
+  in the forked child without an exec. The child's memory is replaced
+  by a copy of the image taken just after it was loaded, so it starts
+  as a new `rx` would, without loading the binary and image again.
+
+  Set RX_IN_PROCESS=0 in the environment to always exec.
+  ---------------------------------------------------------------------*/
+
+CELL *Pristine;
+CELL PristineCells, PristineDictionary, PristineInterpret;
+struct stat PristineBinary;
+
+void snapshot_take(char *binary) {
+  if (stat(binary, &PristineBinary) != 0) return;
+  PristineCells = memory[3];
+  if ((Pristine = malloc(PristineCells * sizeof(CELL))) == NULL) return;
+  memcpy(Pristine, memory, PristineCells * sizeof(CELL));
+  PristineDictionary = Dictionary;
+  PristineInterpret = interpret;
+}
+
+/* Only a path to the same file, unchanged, and without a `-m` to
+   change the image size, is run in the child. */
+int snapshot_matches(char **argv) {
+  char *setting = getenv("RX_IN_PROCESS");
+  struct stat info;
+  int i;
+  if (setting != NULL && strcmp(setting, "0") == 0)
+    return 0;
+  if (Pristine == NULL || argv[0] == NULL || strchr(argv[0], '/') == NULL ||
+      stat(argv[0], &info) != 0)
+    return 0;
+  for (i = 1; argv[i] != NULL; i++)
+    if (strcmp(argv[i], "-m") == 0)
+      return 0;
+  return info.st_dev == PristineBinary.st_dev &&
+         info.st_ino == PristineBinary.st_ino &&
+         info.st_size == PristineBinary.st_size &&
+         info.st_mtime == PristineBinary.st_mtime;
+}
+
+/* Reset this thread's VM to a copy of an image, closing any views
+   and directories it left open. Returns 0 if the memory couldn't be
+   mapped. */
+int vm_reset(CELL *image, CELL cells, CELL dictionary, CELL entry) {
+  CELL i;
+  void *at = mmap(memory, (image_size + 1) * sizeof(CELL),
+                  PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+                  (memory ? MAP_FIXED : 0), -1, 0);
+  if (at == MAP_FAILED)
+    return 0;
+  memory = at;
+  memcpy(memory, image, cells * sizeof(CELL));
+  Dictionary = dictionary;
+  interpret = entry;
+  ip = sp = rp = 0;
+  memset(data, 0, sizeof(data));
+  memset(address, 0, sizeof(address));
+  Output = NULL;
+  OutputDepth = 0;
+  for (i = 1; i < MAX_OPEN_FILES; i++)
+    if (OpenFileHandles[i] != NULL)
+      file_close_slot(i);
+  for (i = 1; i < MAX_FILE_VIEWS; i++)
+    if (FileViews[i].data != NULL) {
+      munmap(FileViews[i].data, FileViews[i].size);
+      FileViews[i].data = NULL;
+    }
+  for (i = 1; i < MAX_OPEN_DIRS; i++)
+    if (OpenDirs[i].dir != NULL) {
+      closedir(OpenDirs[i].dir);
+      OpenDirs[i].dir = NULL;
+    }
+  for (i = 1; i < MAX_PROCESSES; i++)
+    if (Processes[i].pid != 0)
+      process_forget(i);
+  WatchCount = WatchNext = 0;
+  ProfilerWordCount = ProfilerLatest = 0;
+  return 1;
+}
+
+/* The child shares its files' offsets with the parent, so they are
+   forgotten rather than closed. Pipes are closed, as an exec would
+   close them. Anything the parent had buffered from stdin is dropped,
+   as an exec would start reading fd 0 afresh (which may also be a
+   pipe by now). */
+void snapshot_run(int argc, char **argv) {
+  CELL i;
+  __fpurge(stdin);
+  clearerr(stdin);
+  for (i = 1; i < MAX_OPEN_FILES; i++)
+    if (PipeChild[i] && OpenFileHandles[i])
+      close(fileno(OpenFileHandles[i]));
+  memset(PipeChild, 0, sizeof(PipeChild));
+  memset(OpenFileHandles, 0, sizeof(OpenFileHandles));
+  memset(LineIndex, 0, sizeof(LineIndex));
+  memset(LineCount, 0, sizeof(LineCount));
+  if (!vm_reset(Pristine, PristineCells, PristineDictionary,
+                PristineInterpret))
+    return;
+  jobs_forget();
+  profiler_forget();
+  stats_reset();
+#ifdef NGA_BUNDLE_PROFILE
+  memset(BundleCounts, 0, sizeof(BundleCounts));
+#endif
+  sys_argc = argc;
+  sys_argv = argv;
+  run_arguments(argc, argv);
+  exit(0);
+}
+
+/*---------------------------------------------------------------------
+  Jobs run a quote or a script on another VM, using a pool of worker
+  threads. A quote runs on a copy of the caller's image (up to Heap)
+  with one value on the stack, so anything it's given, like a string,
+  must be in the heap rather than a temporary. A script runs on a copy
+  of the image as loaded, as `rx` would run it. The result of a job is
+  the top of its stack at the end, or 0 if this is empty.
+
+  Up to one worker per core is started. Workers waiting on another job
+  don't count towards this, so a job can start others and wait on them.
+
+  A handle is the slot, plus MAX_JOBS times a count of the jobs queued
+  in that slot. The first `job:wait` on a handle frees the slot, so any
+  other wait on it (even one already waiting) returns 0 rather than
+  the result of a later job in the same slot.
+  ---------------------------------------------------------------------*/
+
+#define MAX_JOBS     64
+#define MAX_WORKERS  64
+
+#define JOB_FREE     0
+#define JOB_QUEUED   1
+#define JOB_RUNNING  2
+#define JOB_DONE     3
+
+struct Job {
+  int state;
+  CELL generation;                /* Jobs queued in this slot so far  */
+  long order;                     /* Jobs are started first-come      */
+  CELL *image;                    /* Copy of the caller's image, and  */
+  CELL cells, dictionary, entry;
+  CELL xt, value;                 /* the quote to run with its input  */
+  char *line;                     /* Or, a script and arguments       */
+  CELL result;
+} Jobs[MAX_JOBS];
+
+pthread_mutex_t JobLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t JobQueued = PTHREAD_COND_INITIALIZER;
+pthread_cond_t JobDone = PTHREAD_COND_INITIALIZER;
+long JobOrder;
+int Workers, IdleWorkers, WaitingWorkers, WorkerLimit;
+VM_LOCAL int JobWorker;
+
+/* A forked child has only the thread that forked it. */
+void jobs_forget() {
+  memset(Jobs, 0, sizeof(Jobs));
+  pthread_mutex_init(&JobLock, NULL);
+  pthread_cond_init(&JobQueued, NULL);
+  pthread_cond_init(&JobDone, NULL);
+  Workers = IdleWorkers = WaitingWorkers = 0;
+}
+
+CELL job_cores() {
+  long cores;
+  if (WorkerLimit == 0) {
+    cores = sysconf(_SC_NPROCESSORS_ONLN);
+    WorkerLimit = (cores < 1) ? 1 : (cores > MAX_WORKERS) ? MAX_WORKERS : cores;
+  }
+  return WorkerLimit;
+}
+
+/* These are called with JobLock held. */
+CELL job_slot(CELL handle) {
+  CELL slot = (handle > 0) ? handle % MAX_JOBS : 0;
+  if (slot == 0 || Jobs[slot].state == JOB_FREE ||
+      Jobs[slot].generation != handle / MAX_JOBS)
+    return 0;
+  return slot;
+}
+
+struct Job *job_next() {
+  struct Job *next = NULL;
+  int i;
+  for (i = 1; i < MAX_JOBS; i++)
+    if (Jobs[i].state == JOB_QUEUED &&
+        (next == NULL || Jobs[i].order < next->order))
+      next = &Jobs[i];
+  return next;
+}
+
+void job_run(struct Job *job) {
+  char *args[128], *state;
+  int argc = 1;
+  job->result = 0;
+  if (job->line == NULL) {
+    if (!vm_reset(job->image, job->cells, job->dictionary, job->entry))
+      return;
+    stack_push(job->value);
+    execute(job->xt);
+  } else {
+    if (Pristine == NULL || !vm_reset(Pristine, PristineCells,
+                                      PristineDictionary, PristineInterpret))
+      return;
+    args[0] = "rx";
+    for (args[argc] = strtok_r(job->line, " \t\n", &state);
+         args[argc] != NULL && argc < 127;
+         args[++argc] = strtok_r(NULL, " \t\n", &state))
+      ;
+    args[argc] = NULL;
+    if (argc < 2)
+      return;
+    sys_argc = argc;
+    sys_argv = args;
+    include_file(args[1]);
+  }
+  if (sp > 0)
+    job->result = data[sp];
+}
+
+void *job_worker(void *unused) {
+  struct Job *job;
+  JobWorker = 1;
+#ifdef NGA_JIT
+  jit_prepare();
+#endif
+  pthread_mutex_lock(&JobLock);
+  for (;;) {
+    while ((job = job_next()) == NULL) {
+      IdleWorkers++;
+      pthread_cond_wait(&JobQueued, &JobLock);
+      IdleWorkers--;
+    }
+    job->state = JOB_RUNNING;
+    pthread_mutex_unlock(&JobLock);
+    job_run(job);
+    pthread_mutex_lock(&JobLock);
+    job->state = JOB_DONE;
+    pthread_cond_broadcast(&JobDone);
+  }
+  return unused;
+}
+
+void job_wake() {
+  pthread_t thread;
+  if (IdleWorkers == 0 && Workers < MAX_WORKERS &&
+      Workers - WaitingWorkers < job_cores() &&
+      pthread_create(&thread, NULL, job_worker, NULL) == 0) {
+    pthread_detach(thread);
+    Workers++;
+  }
+  pthread_cond_signal(&JobQueued);
+}
+
+CELL job_queue(struct Job *job) {
+  CELL slot;
+  pthread_mutex_lock(&JobLock);
+  for (slot = 1; slot < MAX_JOBS && Jobs[slot].state != JOB_FREE; slot++)
+    ;
+  if (slot < MAX_JOBS) {
+    job->generation = Jobs[slot].generation % (CELL_MAX / MAX_JOBS) + 1;
+    Jobs[slot] = *job;
+    Jobs[slot].state = JOB_QUEUED;
+    Jobs[slot].order = ++JobOrder;
+    job_wake();
+    slot += job->generation * MAX_JOBS;
+  } else {
+    free(job->image);
+    free(job->line);
+    slot = 0;
+  }
+  pthread_mutex_unlock(&JobLock);
+  return slot;
+}
+
+void job_start() {
+  struct Job job;
+  memset(&job, 0, sizeof(job));
+  job.xt = stack_pop();
+  job.value = stack_pop();
+  job.cells = memory[3];
+  job.dictionary = Dictionary;
+  job.entry = interpret;
+  if (job.cells <= 0 || job.cells > image_size ||
+      (job.image = malloc(job.cells * sizeof(CELL))) == NULL) {
+    stack_push(0);
+    return;
+  }
+  memcpy(job.image, memory, job.cells * sizeof(CELL));
+  stack_push(job_queue(&job));
+}
+
+void job_script() {
+  struct Job job;
+  memset(&job, 0, sizeof(job));
+  if ((job.line = strdup(string_extract(stack_pop()))) == NULL) {
+    stack_push(0);
+    return;
+  }
+  stack_push(job_queue(&job));
+}
+
+void job_wait() {
+  CELL handle = stack_pop();
+  CELL slot, generation, result = 0;
+  pthread_mutex_lock(&JobLock);
+  if ((slot = job_slot(handle)) != 0) {
+    generation = Jobs[slot].generation;
+    if (JobWorker) {
+      WaitingWorkers++;
+      if (job_next() != NULL)
+        job_wake();
+    }
+    while (job_slot(handle) != 0 && Jobs[slot].state != JOB_DONE)
+      pthread_cond_wait(&JobDone, &JobLock);
+    if (JobWorker)
+      WaitingWorkers--;
+    if (job_slot(handle) != 0) {
+      result = Jobs[slot].result;
+      free(Jobs[slot].image);
+      free(Jobs[slot].line);
+      memset(&Jobs[slot], 0, sizeof(struct Job));
+      Jobs[slot].generation = generation;
+    }
+  }
+  pthread_mutex_unlock(&JobLock);
+  stack_push(result);
+}
+
+void job_done() {
+  CELL slot;
+  CELL done = 0;
+  pthread_mutex_lock(&JobLock);
+  if ((slot = job_slot(stack_pop())) != 0 && Jobs[slot].state == JOB_DONE)
+    done = -1;
+  pthread_mutex_unlock(&JobLock);
+  stack_push(done);
+}
+
+void job_count_cores() {
+  stack_push(job_cores());
+}
+
+Handler JobActions[] = {
+  job_start,  job_script,
+  job_wait,   job_done,
+  job_count_cores
+};
+
+void query_jobs() {
+  stack_push(0);
+  stack_push(16);
+}
+
+void io_jobs() {
+  JobActions[stack_pop()]();
+}
+
+/* Memory is mapped rather than cleared: untouched pages read as zero
+   (nop) and are never allocated. */
 void prepare_vm() {
+  memory = mmap(NULL, (image_size + 1) * sizeof(CELL),
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED) {
+    fprintf(stderr, "rx: unable to map %d cells of memory\n", image_size);
+    exit(1);
+  }
   ip = sp = rp = 0;
-  for (ip = 0; ip < IMAGE_SIZE; ip++)
-    memory[ip] = 0; /* NO - nop instruction */
   for (ip = 0; ip < STACK_DEPTH; ip++)
     data[ip] = 0;
   for (ip = 0; ip < ADDRESSES; ip++)
@@ -670,7 +4067,7 @@ void inst_du() {
 void inst_dr() {
   data[sp] = 0;
    if (--sp < 0)
-     ip = IMAGE_SIZE;
+     ip = image_size;
 }
 
 void inst_sw() {
@@ -698,6 +4095,7 @@ void inst_ju() {
 }
 
 void inst_ca() {
+  PROFILER_ENTER(profiler_calls, TOS);
   rp++;
   TORS = ip;
   ip = TOS - 1;
@@ -709,6 +4107,7 @@ void inst_cc() {
   a = TOS; inst_dr();  /* Target */
   b = TOS; inst_dr();  /* Flag   */
   if (b != 0) {
+    PROFILER_ENTER(profiler_calls, a);
     rp++;
     TORS = ip;
     ip = a - 1;
@@ -744,7 +4143,7 @@ void inst_fe() {
     switch (TOS) {
       case -1: TOS = sp - 1; break;
       case -2: TOS = rp; break;
-      case -3: TOS = IMAGE_SIZE; break;
+      case -3: TOS = image_size; break;
       case -4: TOS = CELL_MIN; break;
       case -5: TOS = CELL_MAX; break;
       default: TOS = memory[TOS]; break;
@@ -818,7 +4217,7 @@ void inst_zr() {
 }
 
 void inst_ha() {
-  ip = IMAGE_SIZE;
+  ip = image_size;
 }
 
 void inst_ie() {
@@ -829,13 +4228,19 @@ void inst_ie() {
 void inst_iq() {
   CELL Device = TOS;
   inst_dr();
-  IO_queryHandlers[Device]();
+  if (IoStatsOn)
+    io_measured(Device, 1);
+  else
+    IO_queryHandlers[Device]();
 }
 
 void inst_ii() {
   CELL Device = TOS;
   inst_dr();
-  IO_deviceHandlers[Device]();
+  if (IoStatsOn)
+    io_measured(Device, 0);
+  else
+    IO_deviceHandlers[Device]();
 }
 
 Handler instructions[] = {
@@ -874,57 +4279,57 @@ void process_opcode_bundle(CELL opcode) {
   }
 }
 
-int32_t ngaImageCells = 1027;
+int32_t ngaImageCells = 1032;
 int32_t ngaImage[] = {
-1793,-1,1011,1536,202107,376,348,1027,1535,0,10,1,10,2,10,3,10,4,10,
+1793,-1,1016,1536,202107,381,354,1032,1535,0,10,1,10,2,10,3,10,4,10,
                        5,10,6,10,7,10,8,10,9,10,10,11,10,12,10,13,10,14,10,15,
                        10,16,10,17,10,18,10,19,10,20,10,21,10,22,10,23,10,24,10,25,
                        10,68223234,1,2575,85000450,1,656912,0,0,268505089,67,66,285281281,0,67,2063,10,101384453,0,9,
-                       10,2049,60,25,459011,80,524546,80,302256641,1,10,16974595,0,50529798,10,25,524547,99,50529798,10,
-                       17108738,1,251790353,101777669,1,17565186,90,524545,94,68,167838467,-1,134287105,3,63,659457,3,459023,111,2049,
-                       60,25,2049,111,1793,118,2049,118,117506307,0,111,0,524545,29,116,168820993,0,130,1642241,130,
-                       134283523,11,116,1793,111,524545,2049,111,1793,111,16846593,130,144,161,1793,68,16846593,130,116,161,
-                       1793,68,7,10,659713,1,659713,2,659713,3,1793,171,17108737,3,2,524559,111,2049,111,2049,
-                       111,2049,125,168820998,2,0,0,167841793,184,9,17826049,0,184,2,15,25,524546,167,134287105,185,
-                       99,2305,186,459023,194,134287361,185,189,659201,184,10,659969,7,2049,60,25,17694978,58,210,9,
-                       84152833,48,319750404,209,117507601,212,184618754,45,25,16974851,-1,168886532,1,134284289,1,225,134284289,0,212,660227,
-                       32,0,0,115,105,103,105,108,58,95,0,285278479,242,6,2576,524546,85,1641217,1,167838467,
-                       239,2049,254,2049,250,524545,242,204,17826050,241,0,2572,2563,2049,232,1793,137,459023,137,17760513,
-                       149,3,169,8,251727617,3,2,2049,163,16,168820993,-1,130,2049,204,2049,163,459023,137,285282049,
-                       3,2,134287105,130,289,524545,1793,111,16846593,3,0,111,8,659201,3,524545,29,116,17043201,3,
-                       11,2049,116,2049,111,268505092,130,1642241,130,656131,659201,3,524545,11,116,2049,111,459009,23,116,
-                       459009,58,116,459009,19,116,459009,21,116,1793,9,10,524546,163,134284303,165,1807,0,1642241,241,
-                       285282049,356,1,459012,351,117509889,184,351,134287105,356,204,16845825,0,364,348,1793,68,1793,378,17826050,
-                       356,260,8,117506305,357,367,68,2116,11340,11700,11400,13685,13104,12432,12402,9603,9801,11514,11413,11110,
-                       12528,11948,10302,13340,9700,13455,12753,10500,10670,12654,13320,11960,13908,10088,10605,11865,11025,0,2049,204,
-                       987393,1,1793,111,524546,454,2049,452,2049,452,17891588,2,454,8,17045505,-24,-16,17043736,-8,1118488,
-                       1793,111,17043202,1,169021201,2049,60,25,33883396,101450758,6404,459011,444,34668804,2,2049,441,524545,386,444,
-                       302056196,386,659969,1,0,13,155,100,117,112,0,463,15,155,100,114,111,112,0,470,
-                       17,155,115,119,97,112,0,478,25,155,99,97,108,108,0,486,30,155,101,113,
-                       63,0,494,32,155,45,101,113,63,0,501,34,155,108,116,63,0,509,36,155,
-                       103,116,63,0,516,38,155,102,101,116,99,104,0,523,40,155,115,116,111,114,
-                       101,0,532,42,155,43,0,541,44,155,45,0,546,46,155,42,0,551,48,155,
-                       47,109,111,100,0,556,50,155,97,110,100,0,564,52,155,111,114,0,571,54,
-                       155,120,111,114,0,577,56,155,115,104,105,102,116,0,584,342,161,112,117,115,
-                       104,0,593,345,161,112,111,112,0,601,339,161,48,59,0,608,60,149,102,101,
-                       116,99,104,45,110,101,120,116,0,614,63,149,115,116,111,114,101,45,110,101,
-                       120,116,0,628,232,149,115,58,116,111,45,110,117,109,98,101,114,0,642,99,
-                       149,115,58,101,113,63,0,657,85,149,115,58,108,101,110,103,116,104,0,666,
-                       68,149,99,104,111,111,115,101,0,678,78,155,105,102,0,688,76,149,45,105,
-                       102,0,694,271,161,115,105,103,105,108,58,40,0,701,130,137,67,111,109,112,
-                       105,108,101,114,0,712,3,137,72,101,97,112,0,724,111,149,44,0,732,125,
-                       149,115,44,0,737,131,161,59,0,743,298,161,91,0,748,314,161,93,0,753,
-                       2,137,68,105,99,116,105,111,110,97,114,121,0,758,162,149,100,58,108,105,
-                       110,107,0,772,163,149,100,58,120,116,0,782,165,149,100,58,99,108,97,115,
-                       115,0,790,167,149,100,58,110,97,109,101,0,801,149,149,99,108,97,115,115,
-                       58,119,111,114,100,0,811,161,149,99,108,97,115,115,58,109,97,99,114,111,
-                       0,825,137,149,99,108,97,115,115,58,100,97,116,97,0,840,169,149,100,58,
-                       97,100,100,45,104,101,97,100,101,114,0,854,272,161,115,105,103,105,108,58,
-                       35,0,870,278,161,115,105,103,105,108,58,58,0,881,292,161,115,105,103,105,
-                       108,58,38,0,892,276,161,115,105,103,105,108,58,36,0,903,329,161,114,101,
-                       112,101,97,116,0,914,331,161,97,103,97,105,110,0,924,376,149,105,110,116,
-                       101,114,112,114,101,116,0,933,204,149,100,58,108,111,111,107,117,112,0,946,
-                       155,149,99,108,97,115,115,58,112,114,105,109,105,116,105,118,101,0,958,4,
-                       137,86,101,114,115,105,111,110,0,977,423,149,105,0,988,111,149,100,0,993,
-                       417,149,114,0,998,209,137,66,97,115,101,0,1003,348,149,101,114,114,58,110,
-                       111,116,102,111,117,110,100,0 };
+                       10,2049,60,25,459011,80,1793,87,524546,80,302256641,1,10,16974595,0,50529798,10,25,524547,103,
+                       50529798,10,1793,103,17108738,1,251790353,101777669,1,17565186,92,524545,96,68,167838467,-1,134287105,3,63,659457,
+                       3,459023,115,2049,60,25,2049,115,1793,122,2049,122,117506307,0,115,0,524545,29,120,168820993,
+                       0,134,1642241,134,134283523,11,120,1793,115,524545,2049,115,1793,115,16846593,134,148,165,1793,68,
+                       16846593,134,120,165,1793,68,7,10,659713,1,659713,2,659713,3,1793,175,17108737,3,2,524559,
+                       115,2049,115,2049,115,2049,129,168820998,2,0,0,167841793,188,9,17826049,0,188,2,15,25,
+                       524546,171,134287105,189,101,2305,190,459023,198,1793,210,134287361,189,193,659201,188,10,659969,7,2049,
+                       60,25,17694978,58,216,9,84152833,48,319750404,215,117507601,218,184618754,45,25,16974851,-1,168886532,1,134284289,
+                       1,231,134284289,0,218,660227,32,0,0,115,105,103,105,108,58,95,0,285278479,248,6,
+                       2576,524546,85,1641217,1,167838467,245,2049,260,2049,256,524545,248,208,17826050,247,0,2572,2563,2049,
+                       238,1793,141,459023,141,17760513,153,3,173,8,251727617,3,2,2049,167,16,168820993,-1,134,2049,
+                       208,2049,167,459023,141,285282049,3,2,134287105,134,295,524545,1793,115,16846593,3,0,115,8,659201,
+                       3,524545,29,120,17043201,3,11,2049,120,2049,115,268505092,134,1642241,134,656131,659201,3,524545,11,
+                       120,2049,115,459009,23,120,459009,58,120,459009,19,120,459009,21,120,1793,9,10,524546,167,
+                       134284303,169,1807,0,1642241,247,285282049,362,1,459012,357,459011,354,134287105,362,208,17563906,0,357,459009,
+                       370,68,1793,383,17826050,362,266,8,117506305,363,372,68,2116,11340,11700,11400,13685,13104,12432,12402,
+                       9603,9801,11514,11413,11110,12528,11948,10302,13340,9700,13455,12753,10500,10670,12654,13320,11960,13908,10088,10605,
+                       11865,11025,0,2049,208,987393,1,1793,115,524546,459,2049,457,2049,457,17891588,2,459,8,17045505,
+                       -24,-16,17043736,-8,1118488,1793,115,17043202,1,169021201,2049,60,25,33883396,101450758,6404,459011,449,34668804,2,
+                       2049,446,524545,391,449,302056196,391,659969,1,0,13,159,100,117,112,0,468,15,159,100,
+                       114,111,112,0,475,17,159,115,119,97,112,0,483,25,159,99,97,108,108,0,
+                       491,30,159,101,113,63,0,499,32,159,45,101,113,63,0,506,34,159,108,116,
+                       63,0,514,36,159,103,116,63,0,521,38,159,102,101,116,99,104,0,528,40,
+                       159,115,116,111,114,101,0,537,42,159,43,0,546,44,159,45,0,551,46,159,
+                       42,0,556,48,159,47,109,111,100,0,561,50,159,97,110,100,0,569,52,159,
+                       111,114,0,576,54,159,120,111,114,0,582,56,159,115,104,105,102,116,0,589,
+                       348,165,112,117,115,104,0,598,351,165,112,111,112,0,606,345,165,48,59,0,
+                       613,60,153,102,101,116,99,104,45,110,101,120,116,0,619,63,153,115,116,111,
+                       114,101,45,110,101,120,116,0,633,238,153,115,58,116,111,45,110,117,109,98,
+                       101,114,0,647,101,153,115,58,101,113,63,0,662,85,153,115,58,108,101,110,
+                       103,116,104,0,671,68,153,99,104,111,111,115,101,0,683,78,159,105,102,0,
+                       693,76,153,45,105,102,0,699,277,165,115,105,103,105,108,58,40,0,706,134,
+                       141,67,111,109,112,105,108,101,114,0,717,3,141,72,101,97,112,0,729,115,
+                       153,44,0,737,129,153,115,44,0,742,135,165,59,0,748,304,165,91,0,753,
+                       320,165,93,0,758,2,141,68,105,99,116,105,111,110,97,114,121,0,763,166,
+                       153,100,58,108,105,110,107,0,777,167,153,100,58,120,116,0,787,169,153,100,
+                       58,99,108,97,115,115,0,795,171,153,100,58,110,97,109,101,0,806,153,153,
+                       99,108,97,115,115,58,119,111,114,100,0,816,165,153,99,108,97,115,115,58,
+                       109,97,99,114,111,0,830,141,153,99,108,97,115,115,58,100,97,116,97,0,
+                       845,173,153,100,58,97,100,100,45,104,101,97,100,101,114,0,859,278,165,115,
+                       105,103,105,108,58,35,0,875,284,165,115,105,103,105,108,58,58,0,886,298,
+                       165,115,105,103,105,108,58,38,0,897,282,165,115,105,103,105,108,58,36,0,
+                       908,335,165,114,101,112,101,97,116,0,919,337,165,97,103,97,105,110,0,929,
+                       381,153,105,110,116,101,114,112,114,101,116,0,938,208,153,100,58,108,111,111,
+                       107,117,112,0,951,159,153,99,108,97,115,115,58,112,114,105,109,105,116,105,
+                       118,101,0,963,4,141,86,101,114,115,105,111,110,0,982,428,153,105,0,993,
+                       115,153,100,0,998,422,153,114,0,1003,215,141,66,97,115,101,0,1008,354,153,
+                       101,114,114,58,110,111,116,102,111,117,110,100,0 };